@@ -1,42 +1,246 @@
 #include <string.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "assert.h"
 #include "compress40.h"
+#include "batch.h"
+#include "io.h"
 
-static void (*compress_or_decompress)(FILE *input) = compress40;
+static void (*compress_or_decompress)(FILE *input, FILE *output) = 
+	compress40_image;
+static unsigned threads = 1;    /* set with -j */
+static unsigned depth = 0;      /* set with -q; 0 for synchronous batch I/O */
+static unsigned tile = 0;       /* set with -t; 0 for format 2 */
+
+static void compress_stream(FILE *input, FILE *output)
+{
+	compress40_stream(input, output, NULL);
+}
+
+static void decompress_mapped(FILE *input, FILE *output)
+{
+	decompress40_mapped(input, output, NULL);
+}
+
+static void compress_parallel(FILE *input, FILE *output)
+{
+	compress40_parallel(input, output, threads);
+}
+
+static void decompress_parallel(FILE *input, FILE *output)
+{
+	decompress40_parallel(input, output, threads);
+}
+
+static void compress_tiled(FILE *input, FILE *output)
+{
+	compress40_tiled(input, output, tile);
+}
+
+static int compress_checked(FILE *input, FILE *output,
+			    Compress40_buffers unused)
+{
+	(void) unused;
+	return compress40_checked(input, output, tile);
+}
+
+static int compress_staged(FILE *input, FILE *output,
+			   Compress40_buffers unused)
+{
+	(void) unused;
+	return compress40_staged_checked(input, output);
+}
+
+static int decompress_staged(FILE *input, FILE *output,
+			     Compress40_buffers unused)
+{
+	(void) unused;
+	return decompress40_staged_checked(input, output);
+}
+
+/*
+ * Run a batch of input/output pairs from the command line, or from a
+ * manifest on stdin when none are given. With -j N the files are spread
+ * over N workers. With -q N up to N files are read ahead of the workers and
+ * written behind them by a separate I/O engine. Returns the number of
+ * failures.
+ */
+static int run_batch(int decompress, int reference, int argc, char *argv[])
+{
+	/* Workers cannot catch exceptions, so every batch codec is checked */
+	Batch_codec *codec = decompress ? decompress40_checked
+	                                : compress_checked;
+	if (reference) {
+		codec = decompress ? decompress_staged : compress_staged;
+	}
+
+	Batch_T batch = Batch_new(codec, decompress);
+	int failures = 0;
+	if (argc > 0) {
+		for (int i = 0; i < argc; i += 2) {
+			Batch_add(batch, argv[i], argv[i + 1]);
+		}
+	} else {
+		failures += Batch_add_manifest(batch, stdin);
+	}
+	if (depth > 0) {
+		failures += Batch_run_async(batch, threads, depth);
+	} else {
+		failures += Batch_run(batch, threads);
+	}
+	Batch_free(&batch);
+
+	return failures;
+}
 
 int main(int argc, char *argv[])
 {
-    int i
+	int i;
+	int decompress = 0;
+	int reference = 0;    /* use the staged reference pipeline */
+	int streaming = 0;    /* work two rows at a time */
+	int pipelined = 0;    /* read, transform and write on separate threads */
+	int batch = 0;        /* many input/output pairs in one process */
 	
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-c") == 0) {
-			compress_or_decompress = compress40;
+			decompress = 0;
 		} else if (strcmp(argv[i], "-d") == 0) {
-			compress_or_decompress = decompress40;
+			decompress = 1;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			reference = 1;
+		} else if (strcmp(argv[i], "-s") == 0) {
+			streaming = 1;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			pipelined = 1;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			batch = 1;
+		} else if (strcmp(argv[i], "-n") == 0) {
+			/* Keep files read or written once out of the page cache */
+			IO_set_cache_mode(IO_CACHE_STREAM);
+		} else if (strcmp(argv[i], "-j") == 0) {
+			char *end = NULL;
+			long n = i + 1 < argc ? strtol(argv[++i], &end, 10) : 0;
+			if (n <= 0 || *end != '\0') {
+				fprintf(stderr, "%s: -j expects a positive "
+						"number of threads\n", argv[0]);
+				exit(1);
+			}
+			threads = n;
+		} else if (strcmp(argv[i], "-q") == 0) {
+			char *end = NULL;
+			long n = i + 1 < argc ? strtol(argv[++i], &end, 10) : 0;
+			if (n <= 0 || *end != '\0') {
+				fprintf(stderr, "%s: -q expects a positive "
+						"queue depth\n", argv[0]);
+				exit(1);
+			}
+			depth = n;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			/* Write tiles of N x N blocks (format 3) */
+			char *end = NULL;
+			long n = i + 1 < argc ? strtol(argv[++i], &end, 10) : 0;
+			if (n <= 0 || (unsigned long) n > UINT_MAX
+			    || *end != '\0') {
+				fprintf(stderr, "%s: -t expects a positive "
+						"tile size in blocks\n", argv[0]);
+				exit(1);
+			}
+			tile = n;
 		} else if (*argv[i] == '-') {
 			fprintf(stderr, "%s: unknown option '%s'\n",
 					argv[0], argv[i]);
 			exit(1);
-		} else if (argc - i > 2) {
-			fprintf(stderr, "Usage: %s -d [filename]\n"
-					"       %s -c [filename]\n",
-					argv[0], argv[0]);
+		} else if (!batch && argc - i > 2) {
+			fprintf(stderr, "Usage: %s -d [-r | -p | -j N] [-n] "
+					"[filename]\n"
+					"       %s -c [-r | -s | -p | -j N | -t N] "
+					"[-n] [filename]\n"
+					"       %s -c | -d -b [-r | -t N] [-j N] "
+					"[-q N] [-n] [input output ...]\n",
+					argv[0], argv[0], argv[0]);
 			exit(1);
 		} else {
 			break;
 		}
 	}
+
+	/* Only compress40_tiled cuts tiles, so any other path would ignore -t */
+	if (tile > 0 && (decompress || reference || streaming
+				   || pipelined || (!batch && threads > 1))) {
+		fprintf(stderr, "%s: -t only applies to compression and cannot "
+				"be combined with -r, -s, -p or -j N on one image\n",
+				argv[0]);
+		exit(1);
+	}
+
+	/* One codec runs on a single image, so its flags exclude each other */
+	if (!batch && reference + streaming + pipelined + (threads > 1) > 1) {
+		fprintf(stderr, "%s: only one of -r, -s, -p and -j N may be "
+				"given for one image\n", argv[0]);
+		exit(1);
+	}
+	if (decompress && streaming) {
+		fprintf(stderr, "%s: -s only applies to compression; "
+				"decompression always streams\n", argv[0]);
+		exit(1);
+	}
+
+	/* The batch codecs stream already and have no pipelined variant */
+	if (batch && (streaming || pipelined)) {
+		fprintf(stderr, "%s: -s and -p cannot be combined with -b\n",
+				argv[0]);
+		exit(1);
+	}
+	if (!batch && depth > 0) {
+		fprintf(stderr, "%s: -q only applies to -b\n", argv[0]);
+		exit(1);
+	}
+
+	if (batch) {
+		if ((argc - i) % 2 != 0) {
+			fprintf(stderr, "%s: -b expects input/output pairs\n",
+					argv[0]);
+			exit(1);
+		}
+		int failures = run_batch(decompress, reference, argc - i,
+					 argv + i);
+		return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (reference) {
+		compress_or_decompress = decompress ? decompress40_staged
+		                                    : compress40_staged;
+	} else if (tile > 0) {
+		/* Tiles are cut from the whole image */
+		compress_or_decompress = compress_tiled;
+	} else if (pipelined) {
+		compress_or_decompress = decompress ? decompress40_pipeline
+		                                    : compress40_pipeline;
+	} else if (threads > 1) {
+		compress_or_decompress = decompress ? decompress_parallel
+		                                    : compress_parallel;
+	} else if (decompress || streaming) {
+		/*
+		 * Decompression always streams, from a mapping of the file when
+		 * it can, unless -r asks for the reference
+		 */
+		compress_or_decompress = decompress ? decompress_mapped
+		                                    : compress_stream;
+	}
+
 	assert(argc - i <= 1);    /* at most one file on command line */
 	if (i < argc) {
 		FILE *fp = fopen(argv[i], "r");
 		assert(fp != NULL);
-		compress_or_decompress(fp);
+		compress_or_decompress(fp, stdout);
+		IO_release_cache(fp);
 		fclose(fp);
 	} else {
-		compress_or_decompress(stdin);
+		compress_or_decompress(stdin, stdout);
 	}
+	IO_release_cache(stdout);
 
 	return EXIT_SUCCESS; 
 }
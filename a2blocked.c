@@ -1,5 +1,6 @@
 #include <string.h>
 
+#include "a2methods.h"
 #include <a2blocked.h>
 #include "uarray2b.h"
 
@@ -94,6 +95,7 @@ static struct A2Methods_T uarray2_methods_blocked_struct = {
 	NULL,			// small_map_col_major
 	small_map_block_major,
 	small_map_block_major,	// small_map_default
+	NULL,			// view
 };
 
 // finally the payoff: here is the exported pointer to the struct
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 
+#include "a2methods.h"
 #include <a2plain.h>
 #include "uarray2.h"
 
@@ -98,6 +99,12 @@ static void small_map_col_major(A2Methods_UArray2        a2,
     UArray2_map_col_major(a2, apply_small, &mycl);
 }
 
+static A2Methods_UArray2 view(A2Methods_UArray2 uarray2, int col, int row,
+                              int width, int height)
+{
+    return UArray2_view(uarray2, col, row, width, height);
+}
+
 // elide stop
 
 /*
@@ -124,7 +131,8 @@ static struct A2Methods_T uarray2_methods_plain_struct = {
     small_map_row_major,
     small_map_col_major,
     NULL,
-    small_map_row_major
+    small_map_row_major,
+    view
 // elide stop
 };
 
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "utest.h"
+#include "batch.h"
+#include "compress40.h"
+
+static const char good_plain[] = "P3\n4 2\n255\n"
+                                 "1 2 3 4 5 6 7 8 9 10 11 12\n"
+                                 "13 14 15 16 17 18 19 20 21 22 23 24\n";
+static const char bad_plain[] = "P3\n4 2\n255\n1 2 3 4 x 6\n";
+
+/* The batch codecs of 40image -c and 40image -c -r */
+static int compress(FILE *input, FILE *output, Compress40_buffers unused)
+{
+    (void) unused;
+    return compress40_checked(input, output, 0);
+}
+
+static int compress_staged(FILE *input, FILE *output,
+                           Compress40_buffers unused)
+{
+    (void) unused;
+    return compress40_staged_checked(input, output);
+}
+
+static void write_file(const char *dir, const char *name, const char *text,
+                       size_t size)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "wb");
+    fwrite(text, 1, size, fp);
+    fclose(fp);
+}
+
+static int file_exists(const char *dir, const char *name)
+{
+    char path[96];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return stat(path, &st) == 0 && st.st_size > 0;
+}
+
+static void remove_file(const char *dir, const char *name)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    remove(path);
+}
+
+/* Add good.ppm, bad.ppm and raw.ppm of dir to batch, to out0 to out2 */
+static void add_inputs_only(Batch_T batch, const char *dir)
+{
+    const char *names[] = { "good.ppm", "bad.ppm", "raw.ppm" };
+    for (int k = 0; k < 3; k++) {
+        char input[96], output[96];
+        snprintf(input, sizeof(input), "%s/%s", dir, names[k]);
+        snprintf(output, sizeof(output), "%s/out%d", dir, k);
+        Batch_add(batch, input, output);
+    }
+}
+
+/*
+ * Write a good plain image, a plain image with a malformed sample and a good
+ * raw image into dir, and add them to batch with outputs out0 to out2
+ */
+static void add_inputs(Batch_T batch, const char *dir)
+{
+    char raw[40] = "P6\n4 2\n255\n";
+    size_t header = strlen(raw);
+    for (int k = 0; k < 24; k++) {
+        raw[header + k] = 10 * k;
+    }
+    write_file(dir, "good.ppm", good_plain, strlen(good_plain));
+    write_file(dir, "bad.ppm", bad_plain, strlen(bad_plain));
+    write_file(dir, "raw.ppm", raw, header + 24);
+    add_inputs_only(batch, dir);
+}
+
+static void remove_inputs(const char *dir)
+{
+    const char *names[] = { "good.ppm", "bad.ppm", "raw.ppm",
+                            "out0", "out1", "out2" };
+    for (int k = 0; k < 6; k++) {
+        remove_file(dir, names[k]);
+    }
+    rmdir(dir);
+}
+
+UTEST(Batch, MalformedPlainFailsAloneOnWorkers)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    Batch_T batch = Batch_new(compress, 0);
+    add_inputs(batch, dir);
+
+    EXPECT_EQ(1, Batch_run(batch, 2));
+    EXPECT_TRUE(file_exists(dir, "out0"));
+    EXPECT_FALSE(file_exists(dir, "out1"));
+    EXPECT_TRUE(file_exists(dir, "out2"));
+
+    Batch_free(&batch);
+    remove_inputs(dir);
+}
+
+UTEST(Batch, MalformedPlainFailsAloneAsync)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    Batch_T batch = Batch_new(compress, 0);
+    add_inputs(batch, dir);
+
+    EXPECT_EQ(1, Batch_run_async(batch, 1, 4));
+    EXPECT_TRUE(file_exists(dir, "out0"));
+    EXPECT_FALSE(file_exists(dir, "out1"));
+    EXPECT_TRUE(file_exists(dir, "out2"));
+
+    Batch_free(&batch);
+    remove_inputs(dir);
+}
+
+UTEST(Batch, MalformedPlainFailsAloneWithStagedCodec)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    Batch_T batch = Batch_new(compress_staged, 0);
+    add_inputs(batch, dir);
+
+    EXPECT_EQ(1, Batch_run(batch, 2));
+    EXPECT_TRUE(file_exists(dir, "out0"));
+    EXPECT_FALSE(file_exists(dir, "out1"));
+    EXPECT_TRUE(file_exists(dir, "out2"));
+    remove_file(dir, "out0");
+    remove_file(dir, "out2");
+
+    EXPECT_EQ(1, Batch_run_async(batch, 2, 4));
+    EXPECT_TRUE(file_exists(dir, "out0"));
+    EXPECT_FALSE(file_exists(dir, "out1"));
+    EXPECT_TRUE(file_exists(dir, "out2"));
+
+    Batch_free(&batch);
+    remove_inputs(dir);
+}
+
+/* Contents of a file of dir, to be freed with free; sets its size */
+static char *read_file(const char *dir, const char *name, size_t *size)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    char *data = malloc(4096);
+    *size = fread(data, 1, 4096, fp);
+    fclose(fp);
+
+    return data;
+}
+
+/*
+ * Whether running the inputs with run leaves the good outputs identical to
+ * those of one worker running them in order
+ */
+static int matches_serial(const char *dir, int (*run)(Batch_T batch))
+{
+    Batch_T batch = Batch_new(compress, 0);
+    add_inputs(batch, dir);
+    int same = Batch_run(batch, 1) == 1;
+    Batch_free(&batch);
+    size_t sizes[2];
+    char *expected[] = {read_file(dir, "out0", &sizes[0]),
+                        read_file(dir, "out2", &sizes[1])};
+    remove_file(dir, "out0");
+    remove_file(dir, "out2");
+
+    batch = Batch_new(compress, 0);
+    add_inputs(batch, dir);
+    same = same && run(batch) == 1 && !file_exists(dir, "out1");
+    Batch_free(&batch);
+    const char *names[] = {"out0", "out2"};
+    for (int k = 0; k < 2; k++) {
+        size_t size = 0;
+        char *output = read_file(dir, names[k], &size);
+        same = same && expected[k] != NULL && output != NULL
+               && size == sizes[k] && memcmp(output, expected[k], size) == 0;
+        free(output);
+        free(expected[k]);
+    }
+
+    return same;
+}
+
+static int run_on_ring(Batch_T batch)
+{
+    return Batch_run_async(batch, 2, 4);
+}
+
+/* io_uring refuses more than 32768 entries, so this depth has no ring */
+static int run_without_ring(Batch_T batch)
+{
+    return Batch_run_async(batch, 2, 1 << 16);
+}
+
+UTEST(Batch, AsyncMatchesSerialWithAndWithoutRing)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+
+    EXPECT_TRUE(matches_serial(dir, run_on_ring));
+    EXPECT_TRUE(matches_serial(dir, run_without_ring));
+
+    remove_inputs(dir);
+}
+
+/* The batch codecs of 40image -d and 40image -d -r */
+static int decompress_staged(FILE *input, FILE *output,
+                             Compress40_buffers unused)
+{
+    (void) unused;
+    return decompress40_staged_checked(input, output);
+}
+
+static Batch_codec *const decompressors[] = {
+    decompress40_checked, decompress_staged
+};
+
+UTEST(Batch, TruncatedImageFailsAloneOnWorkers)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    Batch_T batch = Batch_new(compress, 0);
+    add_inputs(batch, dir);
+    EXPECT_EQ(1, Batch_run(batch, 1));
+    Batch_free(&batch);
+
+    /* Only the header is read before the workers start */
+    size_t size = 0;
+    char *image = read_file(dir, "out2", &size);
+    ASSERT_TRUE(image != NULL && size > 8);
+    write_file(dir, "good.ppm", image, size);
+    write_file(dir, "bad.ppm", image, size - 8);
+    write_file(dir, "raw.ppm", image, size);
+    free(image);
+
+    for (size_t d = 0; d < 2; d++) {
+        for (int async = 0; async < 2; async++) {
+            batch = Batch_new(decompressors[d], 1);
+            add_inputs_only(batch, dir);
+            EXPECT_EQ(1, async ? Batch_run_async(batch, 2, 4)
+                               : Batch_run(batch, 2));
+            EXPECT_TRUE(file_exists(dir, "out0"));
+            EXPECT_FALSE(file_exists(dir, "out1"));
+            EXPECT_TRUE(file_exists(dir, "out2"));
+            Batch_free(&batch);
+        }
+    }
+
+    remove_inputs(dir);
+}
+
+UTEST(Batch, GrayWithStagedCodecOnWorkers)
+{
+    char dir[] = "/tmp/batch-testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    static const char plain[] = "P2\n4 2\n255\n0 50 100 150\n"
+                                "200 250 30 60\n";
+    static const char bad[] = "P2\n4 2\n255\n0 50 100 150\n"
+                              "200 256 30 60\n";
+    static const char raw[] = "P5\n4 2\n255\n"
+                              "\000\062\144\226\310\372\036\074";
+    write_file(dir, "good.ppm", plain, strlen(plain));
+    write_file(dir, "bad.ppm", bad, strlen(bad));
+    write_file(dir, "raw.ppm", raw, sizeof(raw) - 1);
+
+    Batch_T batch = Batch_new(compress_staged, 0);
+    add_inputs_only(batch, dir);
+    EXPECT_EQ(1, Batch_run(batch, 2));
+    EXPECT_FALSE(file_exists(dir, "out1"));
+    Batch_free(&batch);
+
+    /* Plain and raw samples are the same, and so are their codewords */
+    size_t sizes[2];
+    char *outputs[] = {read_file(dir, "out0", &sizes[0]),
+                       read_file(dir, "out2", &sizes[1])};
+    ASSERT_TRUE(outputs[0] != NULL && outputs[1] != NULL);
+    EXPECT_EQ(0, memcmp(outputs[0], "COMP40 Compressed grayscale", 27));
+    EXPECT_TRUE(sizes[0] == sizes[1]
+                && memcmp(outputs[0], outputs[1], sizes[0]) == 0);
+    free(outputs[0]);
+    free(outputs[1]);
+
+    remove_inputs(dir);
+}
@@ -0,0 +1,817 @@
+/*
+ * batch.c
+ *
+ * Assignment: Arith
+ *
+ * Implementation of batches. With several workers every file is first sized
+ * from its header, then the files are dealt largest-first into one deque per
+ * worker. A worker takes the largest file left in its own deque; once that
+ * is empty it steals the smallest file left in another worker's deque.
+ *
+ * Batch_run_async takes file I/O off the workers. The calling thread becomes
+ * an I/O engine that reads whole inputs ahead of the workers and writes whole
+ * outputs behind them, through io_uring when the kernel offers it and with
+ * plain pread and pwrite otherwise; workers run the codec on memory streams.
+ *
+ * cii exceptions keep a single global handler stack, so worker threads
+ * cannot use TRY. The main thread only reads the header of each file to
+ * size it; the codec checks the rest as it parses it and reports a malformed
+ * file by its return value, so each file is parsed once, on its worker.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "io.h"
+#include "uring.h"
+#include "assert.h"
+#include "mem.h"
+
+#define T Batch_T
+
+/*
+ * struct Job
+ *
+ * One input/output pair.
+ *
+ * @field char *input, *output - File names
+ * @field uint64_t size        - Pixels in the image, used to order the jobs
+ * @field int index            - Position in the batch, used to break ties
+ */
+typedef struct Job {
+    char *input, *output;
+    uint64_t size;
+    int index;
+} *Job;
+
+struct T {
+    Batch_codec *codec;
+    int decompress;
+    struct Job *jobs;
+    int length, capacity;
+};
+
+/*
+ * struct Deque
+ *
+ * Jobs dealt to one worker, largest first. The owner takes from head and
+ * thieves take from tail.
+ *
+ * @field pthread_mutex_t lock - Guards head and tail
+ * @field Job *jobs            - Jobs of this worker
+ * @field int head, tail       - jobs[head, tail) are still to be run
+ */
+typedef struct Deque {
+    pthread_mutex_t lock;
+    Job *jobs;
+    int head, tail;
+} Deque;
+
+/*
+ * struct Worker
+ *
+ * Closure of a worker thread.
+ *
+ * @field T batch       - Batch being run
+ * @field Deque *deques - Deques of every worker
+ * @field unsigned self - Index of this worker's deque
+ * @field unsigned n    - Number of workers
+ * @field int failures  - Number of jobs this worker failed
+ */
+typedef struct Worker {
+    T batch;
+    Deque *deques;
+    unsigned self, n;
+    int failures;
+} Worker;
+
+static char *copy(const char *s)
+{
+    char *c = ALLOC(strlen(s) + 1);
+    strcpy(c, s);
+    return c;
+}
+
+T Batch_new(Batch_codec *codec, int decompress)
+{
+    assert(codec != NULL);
+
+    T batch;
+    NEW(batch);
+    batch->codec = codec;
+    batch->decompress = decompress;
+    batch->jobs = NULL;
+    batch->length = batch->capacity = 0;
+
+    return batch;
+}
+
+void Batch_add(T batch, const char *input, const char *output)
+{
+    assert(batch != NULL && input != NULL && output != NULL);
+
+    if (batch->length == batch->capacity) {
+        batch->capacity = batch->capacity == 0 ? 16 : 2 * batch->capacity;
+        RESIZE(batch->jobs, (long) batch->capacity * sizeof(struct Job));
+    }
+    struct Job job = {
+        .input = copy(input), .output = copy(output), .size = 0,
+        .index = batch->length
+    };
+    batch->jobs[batch->length++] = job;
+}
+
+int Batch_add_manifest(T batch, FILE *manifest)
+{
+    assert(batch != NULL && manifest != NULL);
+
+    char *line = NULL;
+    size_t capacity = 0;
+    int malformed = 0;
+
+    while (getline(&line, &capacity, manifest) != -1) {
+        char *input = strtok(line, " \t\r\n");
+        if (input == NULL || *input == '#') {
+            continue;
+        }
+        char *output = strtok(NULL, " \t\r\n");
+        if (output == NULL || strtok(NULL, " \t\r\n") != NULL) {
+            fprintf(stderr, "40image: expected 'input output' in "
+                    "manifest, got '%s ...'\n", input);
+            malformed++;
+            continue;
+        }
+        Batch_add(batch, input, output);
+    }
+
+    free(line);
+    return malformed;
+}
+
+void Batch_free(T *batch)
+{
+    assert(batch != NULL && *batch != NULL);
+
+    for (int i = 0; i < (*batch)->length; i++) {
+        FREE((*batch)->jobs[i].input);
+        FREE((*batch)->jobs[i].output);
+    }
+    if ((*batch)->jobs != NULL) {
+        FREE((*batch)->jobs);
+    }
+    FREE(*batch);
+}
+
+/*
+ * run_job
+ *
+ * Open the files of a job and run the codec on them. On failure the partial
+ * output is removed.
+ *
+ * @param T batch                    - Batch the job belongs to
+ * @param Job job                    - Job to run
+ * @param Compress40_buffers buffers - Buffers of the calling worker
+ * @param int guarded                - Nonzero to catch exceptions raised by
+ *                                     the codec; only safe on one thread
+ * @return int                       - 1 if the job failed, otherwise 0
+ */
+static int run_job(T batch, Job job, Compress40_buffers buffers, int guarded)
+{
+    FILE *input = fopen(job->input, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "40image: cannot open '%s'\n", job->input);
+        return 1;
+    }
+    FILE *output = fopen(job->output, "wb");
+    if (output == NULL) {
+        fprintf(stderr, "40image: cannot create '%s'\n", job->output);
+        fclose(input);
+        return 1;
+    }
+
+    volatile int failed = 0;
+    if (guarded) {
+        TRY
+            failed = batch->codec(input, output, buffers) != 0;
+        ELSE
+            failed = 1;
+        END_TRY;
+    } else {
+        failed = batch->codec(input, output, buffers) != 0;
+    }
+
+    IO_release_cache(input);
+    fclose(input);
+    IO_release_cache(output);
+    if (fclose(output) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "40image: failed on '%s'\n", job->input);
+        remove(job->output);
+    }
+    return failed;
+}
+
+/*
+ * measure
+ *
+ * Read the header of a job's input to set its size. The rest of the file is
+ * left to the codec, which checks it as it parses it.
+ *
+ * @param T batch - Batch the job belongs to
+ * @param Job job - Job to be sized
+ * @return int    - 1 if the input has no header, otherwise 0
+ */
+static int measure(T batch, Job job)
+{
+    FILE *fp = fopen(job->input, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "40image: cannot open '%s'\n", job->input);
+        return 1;
+    }
+
+    int parsed;
+    if (batch->decompress) {
+        /* The header is two short lines, parsed from its first bytes */
+        unsigned char text[128];
+        size_t n = fread(text, 1, sizeof(text), fp);
+        IO_binary_header header;
+        parsed = IO_parse_header(text, n, &header);
+        job->size = parsed ? (uint64_t) header.width * header.height : 0;
+    } else {
+        IO_ppm_header header;
+        parsed = IO_scan_ppm_header(fp, &header);
+        job->size = parsed ? (uint64_t) header.width * header.height : 0;
+    }
+    fclose(fp);
+
+    if (!parsed) {
+        fprintf(stderr, "40image: failed on '%s'\n", job->input);
+    }
+    return !parsed;
+}
+
+static int largest_first(const void *a, const void *b)
+{
+    Job x = *(Job const *) a, y = *(Job const *) b;
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+/*
+ * take
+ *
+ * Take the next job for worker self: the largest job left in its own deque,
+ * or else the smallest job left in another worker's deque.
+ *
+ * @return Job - NULL once every deque is empty
+ */
+static Job take(Deque *deques, unsigned self, unsigned n)
+{
+    Job job = NULL;
+    Deque *own = &deques[self];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        job = own->jobs[own->head++];
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (unsigned k = 1; job == NULL && k < n; k++) {
+        Deque *victim = &deques[(self + k) % n];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            job = victim->jobs[--victim->tail];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return job;
+}
+
+static void *work(void *cl)
+{
+    Worker *worker = cl;
+    Compress40_buffers buffers = Compress40_buffers_new();
+
+    Job job;
+    while ((job = take(worker->deques, worker->self, worker->n)) != NULL) {
+        worker->failures += run_job(worker->batch, job, buffers, 0);
+    }
+
+    Compress40_buffers_free(&buffers);
+    return NULL;
+}
+
+int Batch_run(T batch, unsigned workers)
+{
+    assert(batch != NULL);
+    assert(workers > 0);
+
+    int failures = 0;
+    if (workers == 1) {
+        Compress40_buffers buffers = Compress40_buffers_new();
+        for (int i = 0; i < batch->length; i++) {
+            failures += run_job(batch, &batch->jobs[i], buffers, 1);
+        }
+        Compress40_buffers_free(&buffers);
+        return failures;
+    }
+
+    /* Size every job and keep those that can be run */
+    Job *order = CALLOC(batch->length > 0 ? batch->length : 1, sizeof(Job));
+    int length = 0;
+    for (int i = 0; i < batch->length; i++) {
+        if (measure(batch, &batch->jobs[i]) == 0) {
+            order[length++] = &batch->jobs[i];
+        } else {
+            failures++;
+        }
+    }
+    qsort(order, length, sizeof(Job), largest_first);
+
+    /* Deal round-robin so every deque is largest-first too */
+    Deque *deques = CALLOC(workers, sizeof(Deque));
+    Worker *closures = CALLOC(workers, sizeof(Worker));
+    pthread_t *tids = CALLOC(workers, sizeof(pthread_t));
+    for (unsigned w = 0; w < workers; w++) {
+        pthread_mutex_init(&deques[w].lock, NULL);
+        deques[w].jobs = CALLOC(length / workers + 1, sizeof(Job));
+        deques[w].head = deques[w].tail = 0;
+    }
+    for (int i = 0; i < length; i++) {
+        Deque *deque = &deques[i % workers];
+        deque->jobs[deque->tail++] = order[i];
+    }
+
+    for (unsigned w = 0; w < workers; w++) {
+        Worker worker = {
+            .batch = batch, .deques = deques, .self = w, .n = workers,
+            .failures = 0
+        };
+        closures[w] = worker;
+        int created = pthread_create(&tids[w], NULL, work, &closures[w]);
+        assert(created == 0);
+    }
+    for (unsigned w = 0; w < workers; w++) {
+        pthread_join(tids[w], NULL);
+        failures += closures[w].failures;
+        pthread_mutex_destroy(&deques[w].lock);
+        FREE(deques[w].jobs);
+    }
+
+    FREE(tids);
+    FREE(closures);
+    FREE(deques);
+    FREE(order);
+    return failures;
+}
+
+/*
+ * struct Load
+ *
+ * A job of Batch_run_async on its way through the I/O engine: its input is
+ * read into memory, a worker runs the codec from and to memory, and the
+ * output is written back from there.
+ *
+ * @field Job job             - Job being run
+ * @field int fd              - File being read or written, or -1
+ * @field unsigned char *data - Whole input, then whole output
+ * @field size_t size, done   - Bytes in data, and bytes read or written
+ * @field struct iovec iov    - Bytes of the read or write on the ring
+ * @field int failed          - Nonzero once the job has failed
+ * @field struct Load *next   - Next load in the same queue
+ */
+typedef struct Load {
+    Job job;
+    int fd;
+    unsigned char *data;
+    size_t size, done;
+    struct iovec iov;
+    int failed;
+    struct Load *next;
+} *Load;
+
+/*
+ * struct Queue
+ *
+ * Loads in the order they were put, linked through next.
+ */
+typedef struct Queue {
+    Load head, *tail;
+    unsigned length;
+} Queue;
+
+/*
+ * struct Engine
+ *
+ * State of Batch_run_async. The I/O thread reads jobs into ready, workers
+ * take them, run them, and put them on coded, and the I/O thread writes them
+ * out. Workers announce each change on the eventfd wake. With a ring, a read
+ * of wake is always in flight, so waiting on the ring catches the workers
+ * too; without one, the I/O thread reads and writes with plain system calls
+ * and blocks on wake when it has nothing to do.
+ *
+ * @field T batch                  - Batch being run
+ * @field pthread_mutex_t lock     - Guards ready, coded and closed
+ * @field pthread_cond_t loaded    - Signalled when ready grows or closes
+ * @field Queue ready, coded       - Jobs read, and jobs run
+ * @field int closed               - Nonzero once ready will not grow
+ * @field int wake                 - eventfd signalled by the workers
+ * @field Uring_T ring             - io_uring, or NULL for system calls
+ * @field unsigned reading         - Reads in flight on the ring
+ * @field unsigned writing         - Writes in flight on the ring
+ * @field int remaining            - Jobs not yet finished
+ * @field int failures             - Jobs that failed
+ */
+typedef struct Engine {
+    T batch;
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    Queue ready, coded;
+    int closed;
+    int wake;
+    Uring_T ring;
+    unsigned reading, writing;
+    int remaining, failures;
+} Engine;
+
+/* Completion data of the wake read; a load's address tags its own */
+#define TAG_WAKE 0
+#define TAG_WRITE 1
+
+static void put(Queue *queue, Load load)
+{
+    load->next = NULL;
+    *queue->tail = load;
+    queue->tail = &load->next;
+    queue->length++;
+}
+
+static void signal_engine(Engine *engine)
+{
+    uint64_t one = 1;
+    ssize_t written = write(engine->wake, &one, sizeof(one));
+    assert(written == sizeof(one));
+}
+
+/*
+ * run_load
+ *
+ * Run the codec on a loaded job, from its input in memory to a new output
+ * buffer that replaces it.
+ */
+static void run_load(T batch, Load load, Compress40_buffers buffers)
+{
+    /* start_read has already failed empty inputs, which fmemopen refuses */
+    FILE *input = fmemopen(load->data, load->size, "rb");
+    char *output_data = NULL;
+    size_t output_size = 0;
+    FILE *output = open_memstream(&output_data, &output_size);
+    assert(input != NULL && output != NULL);
+
+    load->failed = batch->codec(input, output, buffers) != 0;
+    fclose(input);
+    load->failed |= fclose(output) != 0;
+
+    FREE(load->data);
+    load->data = (unsigned char *) output_data;
+    load->size = output_size;
+    load->done = 0;
+}
+
+static void *work_loaded(void *cl)
+{
+    Engine *engine = cl;
+    Compress40_buffers buffers = Compress40_buffers_new();
+
+    for (;;) {
+        pthread_mutex_lock(&engine->lock);
+        while (engine->ready.head == NULL && !engine->closed) {
+            pthread_cond_wait(&engine->loaded, &engine->lock);
+        }
+        Load load = engine->ready.head;
+        if (load != NULL) {
+            engine->ready.head = load->next;
+            if (engine->ready.head == NULL) {
+                engine->ready.tail = &engine->ready.head;
+            }
+            engine->ready.length--;
+        }
+        pthread_mutex_unlock(&engine->lock);
+        if (load == NULL) {
+            break;
+        }
+        signal_engine(engine);
+
+        run_load(engine->batch, load, buffers);
+
+        pthread_mutex_lock(&engine->lock);
+        put(&engine->coded, load);
+        pthread_mutex_unlock(&engine->lock);
+        signal_engine(engine);
+    }
+
+    Compress40_buffers_free(&buffers);
+    return NULL;
+}
+
+/* Number of jobs being read, waiting for a worker, or being written */
+static unsigned in_queue(Engine *engine)
+{
+    pthread_mutex_lock(&engine->lock);
+    unsigned length = engine->ready.length;
+    pthread_mutex_unlock(&engine->lock);
+
+    return length + engine->reading + engine->writing;
+}
+
+/* Hand a job whose input has been read to the workers */
+static void make_ready(Engine *engine, Load load)
+{
+    IO_release_fd(load->fd);
+    close(load->fd);
+    load->fd = -1;
+    load->size = load->done;
+
+    pthread_mutex_lock(&engine->lock);
+    put(&engine->ready, load);
+    pthread_cond_signal(&engine->loaded);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+/* Count a job as done, reporting it and removing its output if it failed */
+static void finish(Engine *engine, Load load)
+{
+    if (load->failed) {
+        fprintf(stderr, "40image: failed on '%s'\n", load->job->input);
+        remove(load->job->output);
+        engine->failures++;
+    }
+    if (load->fd >= 0) {
+        IO_release_fd(load->fd);
+        close(load->fd);
+    }
+    free(load->data);
+    FREE(load);
+    engine->remaining--;
+}
+
+/* Read or write the rest of a load at once; 0 if the file ran out or failed */
+static int transfer(Load load, int writing)
+{
+    while (load->done < load->size) {
+        unsigned char *p = load->data + load->done;
+        size_t n = load->size - load->done;
+        ssize_t moved = writing ? pwrite(load->fd, p, n, load->done)
+                                : pread(load->fd, p, n, load->done);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            return 0;
+        }
+        load->done += moved;
+    }
+
+    return 1;
+}
+
+/* Queue the rest of a load's read or write on the ring */
+static void queue_transfer(Engine *engine, Load load, int writing)
+{
+    load->iov.iov_base = load->data + load->done;
+    load->iov.iov_len = load->size - load->done;
+    uint64_t data = (uintptr_t) load | (writing ? TAG_WRITE : 0);
+    int queued = writing ? Uring_write(engine->ring, load->fd, &load->iov,
+                                       load->done, data)
+                         : Uring_read(engine->ring, load->fd, &load->iov,
+                                      load->done, data);
+    assert(queued);
+}
+
+/*
+ * start_read
+ *
+ * Open a job's input and read all of it, on the ring or else right away.
+ */
+static void start_read(Engine *engine, Job job)
+{
+    int fd = open(job->input, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "40image: cannot open '%s'\n", job->input);
+        if (fd >= 0) {
+            close(fd);
+        }
+        engine->failures++;
+        engine->remaining--;
+        return;
+    }
+
+    Load load;
+    NEW(load);
+    load->job = job;
+    load->fd = fd;
+    load->size = st.st_size;
+    load->done = 0;
+    load->failed = 0;
+    load->data = malloc(load->size + 1);
+    assert(load->data != NULL);
+
+    if (load->size == 0) {
+        /* Emptied since measure, and fmemopen refuses an empty buffer */
+        load->failed = 1;
+        finish(engine, load);
+    } else if (engine->ring != NULL) {
+        queue_transfer(engine, load, 0);
+        engine->reading++;
+    } else if (transfer(load, 0)) {
+        make_ready(engine, load);
+    } else {
+        load->failed = 1;
+        finish(engine, load);
+    }
+}
+
+/*
+ * start_write
+ *
+ * Create a job's output and write the codec's output to it, on the ring or
+ * else right away.
+ */
+static void start_write(Engine *engine, Load load)
+{
+    if (!load->failed) {
+        load->fd = open(load->job->output, O_WRONLY | O_CREAT | O_TRUNC,
+                        0666);
+        if (load->fd < 0) {
+            fprintf(stderr, "40image: cannot create '%s'\n",
+                    load->job->output);
+            engine->failures++;
+            finish(engine, load);
+            return;
+        }
+    }
+
+    if (!load->failed && engine->ring != NULL && load->size > 0) {
+        queue_transfer(engine, load, 1);
+        engine->writing++;
+        return;
+    }
+    if (!load->failed) {
+        load->failed = !transfer(load, 1);
+    }
+    finish(engine, load);
+}
+
+/*
+ * complete
+ *
+ * Handle a completion from the ring: queue the rest of a short read or
+ * write, or move its job on.
+ */
+static void complete(Engine *engine, uint64_t data, int result)
+{
+    Load load = (Load) (uintptr_t) (data & ~(uint64_t) TAG_WRITE);
+    int writing = (data & TAG_WRITE) != 0;
+    if (result > 0) {
+        load->done += result;
+        if (load->done < load->size) {
+            queue_transfer(engine, load, writing);
+            return;
+        }
+    }
+
+    if (writing) {
+        engine->writing--;
+        load->failed = load->done < load->size;
+        finish(engine, load);
+    } else if (load->done < load->size) {
+        /* The read failed or the file shrank since it was opened */
+        engine->reading--;
+        load->failed = 1;
+        finish(engine, load);
+    } else {
+        engine->reading--;
+        make_ready(engine, load);
+    }
+}
+
+int Batch_run_async(T batch, unsigned workers, unsigned depth)
+{
+    assert(batch != NULL);
+    assert(workers > 0 && depth > 0);
+
+    /* As in Batch_run, inputs are sized before any worker starts */
+    Engine engine = {
+        .batch = batch, .closed = 0, .wake = eventfd(0, 0), .reading = 0,
+        .writing = 0, .remaining = 0, .failures = 0
+    };
+    Job *order = CALLOC(batch->length > 0 ? batch->length : 1, sizeof(Job));
+    for (int i = 0; i < batch->length; i++) {
+        if (measure(batch, &batch->jobs[i]) == 0) {
+            order[engine.remaining++] = &batch->jobs[i];
+        } else {
+            engine.failures++;
+        }
+    }
+    qsort(order, engine.remaining, sizeof(Job), largest_first);
+    int length = engine.remaining;
+
+    /* Every job admitted, one per worker, and the wake read can be on it */
+    assert(engine.wake >= 0);
+    engine.ring = Uring_new(depth + workers + 1);
+    engine.ready.head = engine.coded.head = NULL;
+    engine.ready.tail = &engine.ready.head;
+    engine.coded.tail = &engine.coded.head;
+    engine.ready.length = engine.coded.length = 0;
+    pthread_mutex_init(&engine.lock, NULL);
+    pthread_cond_init(&engine.loaded, NULL);
+
+    pthread_t *tids = CALLOC(workers, sizeof(pthread_t));
+    for (unsigned w = 0; w < workers; w++) {
+        int created = pthread_create(&tids[w], NULL, work_loaded, &engine);
+        assert(created == 0);
+    }
+
+    uint64_t count = 0;
+    struct iovec wake = {.iov_base = &count, .iov_len = sizeof(count)};
+    if (engine.ring != NULL) {
+        int queued = Uring_read(engine.ring, engine.wake, &wake, 0,
+                                TAG_WAKE);
+        assert(queued);
+    }
+
+    int next = 0;
+    while (engine.remaining > 0) {
+        pthread_mutex_lock(&engine.lock);
+        Load coded = engine.coded.head;
+        engine.coded.head = NULL;
+        engine.coded.tail = &engine.coded.head;
+        engine.coded.length = 0;
+        pthread_mutex_unlock(&engine.lock);
+
+        while (coded != NULL) {
+            Load load = coded;
+            coded = coded->next;
+            start_write(&engine, load);
+        }
+
+        /*
+         * Keep up to depth jobs being read, read, or being written, so
+         * memory and the operations on the ring stay bounded
+         */
+        while (next < length && in_queue(&engine) < depth) {
+            start_read(&engine, order[next++]);
+        }
+        if (engine.remaining == 0) {
+            break;
+        }
+
+        if (engine.ring == NULL) {
+            ssize_t n = read(engine.wake, &count, sizeof(count));
+            assert(n == sizeof(count));
+            continue;
+        }
+
+        uint64_t data;
+        int result;
+        Uring_wait(engine.ring, &data, &result);
+        if (data == TAG_WAKE) {
+            int queued = Uring_read(engine.ring, engine.wake, &wake, 0,
+                                    TAG_WAKE);
+            assert(queued);
+        } else {
+            complete(&engine, data, result);
+        }
+    }
+
+    pthread_mutex_lock(&engine.lock);
+    engine.closed = 1;
+    pthread_cond_broadcast(&engine.loaded);
+    pthread_mutex_unlock(&engine.lock);
+    for (unsigned w = 0; w < workers; w++) {
+        pthread_join(tids[w], NULL);
+    }
+
+    if (engine.ring != NULL) {
+        Uring_free(&engine.ring);
+    }
+    close(engine.wake);
+    pthread_cond_destroy(&engine.loaded);
+    pthread_mutex_destroy(&engine.lock);
+    FREE(tids);
+    FREE(order);
+    return engine.failures;
+}
+
+#undef T
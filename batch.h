@@ -0,0 +1,96 @@
+/*
+ * batch.h
+ *
+ * Assignment: Arith
+ *
+ * Interface for compressing or decompressing many files in one process.
+ * Clients add input/output pairs, then run them either one after another or
+ * on a pool of worker threads. A file that fails is reported on stderr and
+ * its partial output is removed; the rest of the batch still runs.
+ */
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED
+
+#include <stdio.h>
+#include "compress40.h"
+
+#define T Batch_T
+typedef struct T *T;
+
+/*
+ * The work done for each pair, e.g. decompress40_checked. Each worker passes
+ * its own buffers, so a codec may keep them between files. Workers cannot
+ * catch exceptions, so a codec returns nonzero for a malformed input instead
+ * of raising, as the checked codecs of compress40.h do.
+ */
+typedef int Batch_codec(FILE *input, FILE *output, Compress40_buffers buffers);
+
+/*
+ * Batch_new
+ *
+ * Create an empty batch.
+ *
+ * @param Batch_codec *codec - Work done for each pair
+ * @param int decompress     - Nonzero if inputs are compressed images, zero
+ *                             if they are PPM images. Used to size the work
+ *                             of each file before it runs
+ * @return T                 - Batch to be freed with Batch_free
+ */
+extern T Batch_new(Batch_codec *codec, int decompress);
+
+/*
+ * Batch_add
+ *
+ * Add an input/output pair. Both names are copied.
+ */
+extern void Batch_add(T batch, const char *input, const char *output);
+
+/*
+ * Batch_add_manifest
+ *
+ * Add every "input output" pair of a manifest, one pair per line. Blank lines
+ * and lines starting with '#' are skipped.
+ *
+ * @return int - Number of malformed lines, each reported on stderr
+ */
+extern int Batch_add_manifest(T batch, FILE *manifest);
+
+/*
+ * Batch_run
+ *
+ * Run every pair. With one worker the pairs run in order. With more, files
+ * are dealt largest-first into per-worker deques and idle workers steal from
+ * busy ones, so one large image does not leave the other workers idle.
+ *
+ * @param T batch            - Batch to run
+ * @param unsigned workers   - Number of worker threads, at least 1
+ * @return int               - Number of pairs that failed
+ */
+extern int Batch_run(T batch, unsigned workers);
+
+/*
+ * Batch_run_async
+ *
+ * Run every pair as Batch_run does, but keep file I/O off the workers. The
+ * calling thread reads up to depth inputs ahead of the workers and writes
+ * their outputs as they finish, keeping many reads and writes in flight on
+ * an io_uring. Without io_uring the calling thread does the same with plain
+ * system calls, so I/O still overlaps with the workers.
+ *
+ * @param T batch          - Batch to run
+ * @param unsigned workers - Number of worker threads, at least 1
+ * @param unsigned depth   - Most files read ahead or being written, at
+ *                           least 1
+ * @return int             - Number of pairs that failed
+ */
+extern int Batch_run_async(T batch, unsigned workers, unsigned depth);
+
+/*
+ * Batch_free
+ *
+ * Free a batch and the names it holds.
+ */
+extern void Batch_free(T *batch);
+
+#undef T
+#endif
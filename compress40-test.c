@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "utest.h"
+#include "compress40.h"
+
+/* Threads handed to the parallel codecs by the wrappers below */
+static unsigned threads = 1;
+
+typedef void Codec(FILE *input, FILE *output);
+
+/*
+ * A P6 image of pseudo-random samples. Neighbouring pixels are close so the
+ * codewords are not all saturated. Sets the size of the image.
+ */
+static unsigned char *make_ppm(unsigned width, unsigned height,
+                               unsigned denominator, size_t *size)
+{
+    int bytes = denominator > 255 ? 2 : 1;
+    size_t nbytes = (size_t) width * height * 3 * bytes;
+    unsigned char *image = malloc(nbytes + 32);
+    int header = sprintf((char *) image, "P6\n%u %u\n%u\n", width, height,
+                         denominator);
+
+    unsigned seed = width * 7919 + height * 104729 + denominator;
+    unsigned char *p = image + header;
+    unsigned sample = denominator / 2;
+    for (size_t k = 0; k < nbytes / bytes; k++) {
+        seed = seed * 1103515245 + 12345;
+        sample = (sample + (seed >> 16) % (denominator / 8 + 1))
+                 % (denominator + 1);
+        if (bytes == 2) {
+            *p++ = sample >> 8;
+        }
+        *p++ = sample;
+    }
+    *size = header + nbytes;
+
+    return image;
+}
+
+/* Output of a codec read back from a pipe by its own thread */
+struct Drain {
+    int fd;
+    unsigned char *data;
+    size_t size;
+};
+
+static void *drain(void *cl)
+{
+    struct Drain *d = cl;
+    size_t capacity = 4096;
+    d->data = malloc(capacity);
+    ssize_t n;
+    while ((n = read(d->fd, d->data + d->size, capacity - d->size)) > 0) {
+        d->size += n;
+        if (d->size == capacity) {
+            capacity *= 2;
+            d->data = realloc(d->data, capacity);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Run codec on input from a temporary file, writing to another temporary
+ * file, or to a pipe when to_pipe is nonzero. Returns what it wrote and sets
+ * its size.
+ */
+static unsigned char *run_codec(Codec *codec, const unsigned char *input,
+                                size_t input_size, int to_pipe, size_t *size)
+{
+    FILE *in = tmpfile();
+    fwrite(input, 1, input_size, in);
+    rewind(in);
+
+    unsigned char *data;
+    if (to_pipe) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            return NULL;
+        }
+        struct Drain d = {.fd = fds[0], .data = NULL, .size = 0};
+        pthread_t reader;
+        pthread_create(&reader, NULL, drain, &d);
+        FILE *out = fdopen(fds[1], "w");
+        codec(in, out);
+        fclose(out);
+        pthread_join(reader, NULL);
+        close(fds[0]);
+        data = d.data;
+        *size = d.size;
+    } else {
+        FILE *out = tmpfile();
+        codec(in, out);
+        fflush(out);
+        fseeko(out, 0, SEEK_END);
+        *size = ftello(out);
+        rewind(out);
+        data = malloc(*size + 1);
+        *size = fread(data, 1, *size, out);
+        fclose(out);
+    }
+    fclose(in);
+
+    return data;
+}
+
+/*
+ * Whether codec writes exactly what reference does for input, to a file and
+ * to a pipe
+ */
+static int matches(Codec *codec, Codec *reference, const unsigned char *input,
+                   size_t input_size)
+{
+    size_t expected_size = 0;
+    unsigned char *expected = run_codec(reference, input, input_size, 0,
+                                        &expected_size);
+    int same = 1;
+    for (int to_pipe = 0; to_pipe < 2; to_pipe++) {
+        size_t size = 0;
+        unsigned char *output = run_codec(codec, input, input_size, to_pipe,
+                                          &size);
+        same = same && output != NULL && size == expected_size
+               && memcmp(output, expected, size) == 0;
+        free(output);
+    }
+    free(expected);
+
+    return same;
+}
+
+/* Images with odd sides, sides below a block, and 8- and 16-bit samples */
+static const unsigned sizes[][3] = {
+    {2, 2, 255}, {37, 23, 255}, {64, 48, 255}, {1, 5, 255}, {5, 1, 255},
+    {301, 231, 255}, {33, 18, 65535}, {20, 31, 1000}
+};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Thread counts: one, a few, and more than there are block rows */
+static const unsigned thread_counts[] = {1, 2, 3, 7, 300};
+#define NTHREADS (sizeof(thread_counts) / sizeof(thread_counts[0]))
+
+static void compress_parallel(FILE *input, FILE *output)
+{
+    compress40_parallel(input, output, threads);
+}
+
+UTEST(Compress40, ParallelMatchesStaged)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *image = make_ppm(sizes[s][0], sizes[s][1],
+                                        sizes[s][2], &size);
+        for (size_t t = 0; t < NTHREADS; t++) {
+            threads = thread_counts[t];
+            EXPECT_TRUE(matches(compress_parallel, compress40_staged, image,
+                                size));
+        }
+        free(image);
+    }
+}
+
+/* The staged compression of a generated image, the input of a decoder */
+static unsigned char *make_compressed(unsigned width, unsigned height,
+                                      unsigned denominator, size_t *size)
+{
+    size_t image_size = 0;
+    unsigned char *image = make_ppm(width, height, denominator, &image_size);
+    unsigned char *compressed = run_codec(compress40_staged, image,
+                                          image_size, 0, size);
+    free(image);
+
+    return compressed;
+}
+
+static void decompress_parallel(FILE *input, FILE *output)
+{
+    decompress40_parallel(input, output, threads);
+}
+
+UTEST(Compress40, ParallelDecoderMatchesStaged)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *compressed = make_compressed(sizes[s][0], sizes[s][1],
+                                                    sizes[s][2], &size);
+        for (size_t t = 0; t < NTHREADS; t++) {
+            threads = thread_counts[t];
+            EXPECT_TRUE(matches(decompress_parallel, decompress40_staged,
+                                compressed, size));
+        }
+        free(compressed);
+    }
+}
+
+UTEST(Compress40, PipelineMatchesStaged)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *image = make_ppm(sizes[s][0], sizes[s][1],
+                                        sizes[s][2], &size);
+        EXPECT_TRUE(matches(compress40_pipeline, compress40_staged, image,
+                            size));
+        free(image);
+
+        unsigned char *compressed = make_compressed(sizes[s][0], sizes[s][1],
+                                                    sizes[s][2], &size);
+        EXPECT_TRUE(matches(decompress40_pipeline, decompress40_staged,
+                            compressed, size));
+        free(compressed);
+    }
+}
+
+/*
+ * A PGM of pseudo-random samples, raw (P5) or plain (P2) text when plain is
+ * nonzero. Sets the size of the image.
+ */
+static unsigned char *make_pgm(unsigned width, unsigned height,
+                               unsigned denominator, int plain, size_t *size)
+{
+    size_t count = (size_t) width * height;
+    unsigned char *image = malloc(count * 6 + 32);
+    int length = sprintf((char *) image, "P%c\n%u %u\n%u\n",
+                         plain ? '2' : '5', width, height, denominator);
+
+    unsigned seed = width * 31 + height * 17 + denominator;
+    unsigned char *p = image + length;
+    for (size_t k = 0; k < count; k++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned sample = (seed >> 16) % (denominator + 1);
+        if (plain) {
+            p += sprintf((char *) p, "%u%c", sample,
+                         (k + 1) % width == 0 ? '\n' : ' ');
+        } else {
+            if (denominator > 255) {
+                *p++ = sample >> 8;
+            }
+            *p++ = sample;
+        }
+    }
+    *size = p - image;
+
+    return image;
+}
+
+static void compress_stream(FILE *input, FILE *output)
+{
+    compress40_stream(input, output, NULL);
+}
+
+static void decompress_mapped(FILE *input, FILE *output)
+{
+    decompress40_mapped(input, output, NULL);
+}
+
+/* Each compressor 40image can run on one image, and each decompressor */
+static Codec *const compressors[] = {
+    compress_stream, compress_parallel, compress40_pipeline, compress40_staged
+};
+static Codec *const decompressors[] = {
+    decompress_mapped, decompress_parallel, decompress40_pipeline,
+    decompress40_staged
+};
+#define NCODECS (sizeof(compressors) / sizeof(compressors[0]))
+
+UTEST(Compress40, GrayMatchesInEveryMode)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        for (int plain = 0; plain < 2; plain++) {
+            size_t size = 0;
+            unsigned char *image = make_pgm(sizes[s][0], sizes[s][1],
+                                            sizes[s][2], plain, &size);
+            threads = 3;
+            for (size_t c = 0; c < NCODECS; c++) {
+                EXPECT_TRUE(matches(compressors[c], compress40_image, image,
+                                    size));
+            }
+
+            size_t compressed_size = 0;
+            unsigned char *compressed = run_codec(compress40_image, image,
+                                                  size, 0, &compressed_size);
+            EXPECT_EQ(0, memcmp(compressed, "COMP40 Compressed grayscale", 27));
+            for (size_t c = 0; c < NCODECS; c++) {
+                EXPECT_TRUE(matches(decompressors[c], decompress40_image,
+                                    compressed, compressed_size));
+            }
+            free(compressed);
+            free(image);
+        }
+    }
+}
+
+/* Tile size handed to compress40_tiled by the wrapper below */
+static unsigned tile = 0;
+
+static void compress_tiled(FILE *input, FILE *output)
+{
+    compress40_tiled(input, output, tile);
+}
+
+/* Tiles of one block, of a few, and larger than any image here */
+static const unsigned tile_sizes[] = {1, 3, 64};
+#define NTILES (sizeof(tile_sizes) / sizeof(tile_sizes[0]))
+
+UTEST(Compress40, TiledDecodesLikeUntiled)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *image = make_ppm(sizes[s][0], sizes[s][1],
+                                        sizes[s][2], &size);
+        size_t untiled_size = 0;
+        unsigned char *untiled = run_codec(compress40_staged, image, size, 0,
+                                           &untiled_size);
+        size_t expected_size = 0;
+        unsigned char *expected = run_codec(decompress40_staged, untiled,
+                                            untiled_size, 0, &expected_size);
+
+        /* Tile 0 is format 2, exactly what compress40_image writes */
+        tile = 0;
+        EXPECT_TRUE(matches(compress_tiled, compress40_image, image, size));
+
+        threads = 3;
+        for (size_t t = 0; t < NTILES; t++) {
+            tile = tile_sizes[t];
+            size_t tiled_size = 0;
+            unsigned char *tiled = run_codec(compress_tiled, image, size, 0,
+                                             &tiled_size);
+            EXPECT_EQ(0, memcmp(tiled, "COMP40 Compressed image format 3",
+                                32));
+            for (size_t c = 0; c < NCODECS; c++) {
+                size_t decoded_size = 0;
+                unsigned char *decoded = run_codec(decompressors[c], tiled,
+                                                   tiled_size, 0,
+                                                   &decoded_size);
+                EXPECT_TRUE(decoded_size == expected_size
+                            && memcmp(decoded, expected, decoded_size) == 0);
+                free(decoded);
+            }
+            free(tiled);
+        }
+        free(expected);
+        free(untiled);
+        free(image);
+    }
+}
+
+/*
+ * Whether codec, writing after a prefix already in its output file, leaves
+ * the prefix followed by what reference writes. The file is opened for
+ * appending when append is nonzero, which rules out positional writes.
+ */
+static int matches_after_prefix(Codec *codec, Codec *reference,
+                                const unsigned char *input,
+                                size_t input_size, int append)
+{
+    static const char prefix[] = "prefix of 19 bytes\n";
+    size_t expected_size = 0;
+    unsigned char *expected = run_codec(reference, input, input_size, 0,
+                                        &expected_size);
+
+    FILE *in = tmpfile();
+    fwrite(input, 1, input_size, in);
+    rewind(in);
+    char path[] = "/tmp/compress40-testXXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    FILE *out = fdopen(fd, append ? "a+" : "w+");
+    fputs(prefix, out);
+    codec(in, out);
+    fflush(out);
+
+    size_t prefix_size = strlen(prefix);
+    size_t size = prefix_size + expected_size;
+    unsigned char *output = malloc(size + 1);
+    fseeko(out, 0, SEEK_END);
+    int same = ftello(out) == (off_t) size;
+    rewind(out);
+    same = same && fread(output, 1, size, out) == size
+           && memcmp(output, prefix, prefix_size) == 0
+           && memcmp(output + prefix_size, expected, expected_size) == 0;
+
+    fclose(out);
+    fclose(in);
+    free(output);
+    free(expected);
+
+    return same;
+}
+
+UTEST(Compress40, ParallelWritesAtItsOffsetInAFile)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *image = make_ppm(sizes[s][0], sizes[s][1],
+                                        sizes[s][2], &size);
+        for (size_t t = 0; t < NTHREADS; t++) {
+            threads = thread_counts[t];
+            for (int append = 0; append < 2; append++) {
+                EXPECT_TRUE(matches_after_prefix(compress_parallel,
+                                                 compress40_staged, image,
+                                                 size, append));
+            }
+        }
+        free(image);
+    }
+}
+
+UTEST(Compress40, ParallelDecoderWritesAtItsOffsetInAFile)
+{
+    for (size_t s = 0; s < NSIZES; s++) {
+        size_t size = 0;
+        unsigned char *compressed = make_compressed(sizes[s][0], sizes[s][1],
+                                                    sizes[s][2], &size);
+        for (size_t t = 0; t < NTHREADS; t++) {
+            threads = thread_counts[t];
+            for (int append = 0; append < 2; append++) {
+                EXPECT_TRUE(matches_after_prefix(decompress_parallel,
+                                                 decompress40_staged,
+                                                 compressed, size, append));
+            }
+        }
+        free(compressed);
+    }
+}
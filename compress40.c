@@ -1,7 +1,11 @@
 #include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
 #include "compress40.h"
 #include "io.h"
 #include "transform.h"
+#include "formulas.h"
+#include "ring.h"
 #include "assert.h"
 #include "mem.h"
 #include "pnm.h"
@@ -13,27 +17,843 @@
  */
 const unsigned DENOMINATOR = 255;
 
+/* Bytes of codewords a band packs before each IO_write_at */
+#define BAND_CHUNK 65536
+
+/*
+ * struct Band
+ *
+ * A horizontal band of block rows handed to one thread. Bands never share
+ * a block row, so threads write to disjoint cells.
+ *
+ * @field A2Methods_UArray2 image - Pnm_rgb image to read blocks from when
+ *                                  compressing; NULL when decompressing
+ * @field A2Methods_UArray2 word  - Codeword array shared by all bands when
+ *                                  compressing; NULL when decompressing or
+ *                                  when each band writes its own codewords
+ * @field unsigned char *payload  - Codeword bytes when decompressing; NULL
+ *                                  when compressing
+ * @field unsigned char *pixels   - Raw P6 samples to write when
+ *                                  decompressing; NULL when compressing or
+ *                                  when each band writes its own rows
+ * @field size_t stride           - Bytes per row of pixels
+ * @field int width               - Codewords per block row
+ * @field A2Methods_T methods     - Methods to interact with image and word
+ * @field unsigned denominator    - Denominator of image or pixels
+ * @field int first, last         - Block rows [first, last) of this band
+ * @field FILE *output            - Stream the band writes its codewords or
+ *                                  rows to with IO_write_at when word or
+ *                                  pixels is NULL
+ * @field off_t offset            - Offset of the first codeword or row in
+ *                                  output
+ */
+typedef struct Band {
+    A2Methods_UArray2 image, word;
+    const unsigned char *payload;
+    unsigned char *pixels;
+    size_t stride;
+    int width;
+    A2Methods_T methods;
+    unsigned denominator;
+    int first, last;
+    FILE *output;
+    off_t offset;
+} *Band;
+
+/*
+ * encode_row
+ *
+ * Pack the BLOCKSIZE pixel rows starting at row of image into row word_row
+ * of the codeword array.
+ *
+ * @param A2Methods_UArray2 image - Pnm_rgb image
+ * @param int row                 - Top pixel row of the block row
+ * @param A2Methods_UArray2 word  - Codeword array
+ * @param int word_row            - Row of word to fill
+ * @param A2Methods_T methods     - Methods to interact with image and word
+ * @param unsigned denominator    - Denominator of image
+ */
+static void encode_row(A2Methods_UArray2 image, int row,
+                       A2Methods_UArray2 word, int word_row,
+                       A2Methods_T methods, unsigned denominator)
+{
+    int width = methods->width(word);
+    for (int col = 0; col < width; col++) {
+        uint64_t *cell = methods->at(word, col, word_row);
+        *cell = Transform_encode_block(image, methods, col * BLOCKSIZE, row,
+                                       denominator);
+    }
+}
+
+/*
+ * encode_band
+ *
+ * Thread entry point of compress40_parallel.
+ *
+ * @param void *cl - Pointer to struct Band
+ * @return void *  - Always NULL
+ */
+static void *encode_band(void *cl)
+{
+    Band band = cl;
+    if (band->word != NULL) {
+        for (int j = band->first; j < band->last; j++) {
+            encode_row(band->image, j * BLOCKSIZE, band->word, j,
+                       band->methods, band->denominator);
+        }
+        return NULL;
+    }
+
+    /* Block rows are packed a chunk at a time and stored at their offset */
+    size_t row_bytes = (size_t) band->width * (CODE_LENGTH / CHAR_BIT);
+    int rows = row_bytes > 0 && row_bytes < BAND_CHUNK
+               ? BAND_CHUNK / row_bytes : 1;
+    unsigned char *chunk = ALLOC(row_bytes * rows + 1);
+    for (int j = band->first; j < band->last; j += rows) {
+        int last = j + rows < band->last ? j + rows : band->last;
+        size_t index = 0;
+        for (int row = j; row < last; row++) {
+            for (int col = 0; col < band->width; col++) {
+                uint64_t word = Transform_encode_block(band->image,
+                                                       band->methods,
+                                                       col * BLOCKSIZE,
+                                                       row * BLOCKSIZE,
+                                                       band->denominator);
+                IO_put_word(chunk, index++, word, CODE_LENGTH);
+            }
+        }
+        IO_write_at(band->output, chunk, row_bytes * (last - j),
+                    band->offset + (off_t) row_bytes * j);
+    }
+    FREE(chunk);
+
+    return NULL;
+}
+
+/*
+ * struct Compress40_buffers
+ *
+ * Row buffers of the streaming paths. They are kept between images and only
+ * replaced when an image of a different width arrives.
+ *
+ * @field A2Methods_UArray2 rows - BLOCKSIZE rows of Pnm_rgb pixels
+ * @field A2Methods_UArray2 word - One row of uint64_t codewords
+ * @field unsigned char *raw     - The same BLOCKSIZE rows as raw P6 samples
+ *                                 of DENOMINATOR, as they are written out
+ */
+struct Compress40_buffers {
+    A2Methods_UArray2 rows, word;
+    unsigned char *raw;
+};
+
+/*
+ * fit_buffers
+ *
+ * Make sure buffers hold rows of the given widths, reallocating only the
+ * arrays whose width changed.
+ *
+ * @param Compress40_buffers buffers - Buffers to be checked
+ * @param A2Methods_T methods        - Methods the buffers are allocated with
+ * @param int width                  - Number of pixels per row
+ * @param int word_width             - Number of codewords per row
+ */
+static void fit_buffers(Compress40_buffers buffers, A2Methods_T methods,
+                        int width, int word_width)
+{
+    assert(buffers != NULL);
+
+    if (buffers->rows != NULL && methods->width(buffers->rows) != width) {
+        methods->free(&buffers->rows);
+        FREE(buffers->raw);
+    }
+    if (buffers->rows == NULL) {
+        buffers->rows = methods->new(width, BLOCKSIZE,
+                                     sizeof(struct Pnm_rgb));
+        buffers->raw = ALLOC((size_t) width * BLOCKSIZE * 3 + 1);
+    }
+
+    if (buffers->word != NULL && methods->width(buffers->word) != word_width) {
+        methods->free(&buffers->word);
+    }
+    if (buffers->word == NULL) {
+        buffers->word = methods->new(word_width, 1, sizeof(uint64_t));
+    }
+}
+
+/*
+ * release_buffers
+ *
+ * Free the arrays held by buffers, leaving them empty.
+ *
+ * @param Compress40_buffers buffers - Buffers to be emptied
+ * @param A2Methods_T methods        - Methods the buffers are allocated with
+ */
+static void release_buffers(Compress40_buffers buffers, A2Methods_T methods)
+{
+    if (buffers->rows != NULL) {
+        methods->free(&buffers->rows);
+        FREE(buffers->raw);
+    }
+    if (buffers->word != NULL) {
+        methods->free(&buffers->word);
+    }
+}
+
+/*
+ * decode_row
+ *
+ * Decode the row of codewords in buffers into its raw P6 rows, each codeword
+ * straight to its block with Transform_decode_raw.
+ *
+ * @param Compress40_buffers buffers - Buffers fitted to the image
+ * @param A2Methods_T methods        - Methods the buffers are allocated with
+ */
+static void decode_row(Compress40_buffers buffers, A2Methods_T methods)
+{
+    size_t stride = (size_t) methods->width(buffers->rows) * 3;
+    int width = methods->width(buffers->word);
+    for (int col = 0; col < width; col++) {
+        uint64_t *cell = methods->at(buffers->word, col, 0);
+        Transform_decode_raw(*cell, buffers->raw, buffers->raw + stride,
+                             col * BLOCKSIZE, DENOMINATOR);
+    }
+}
+
+/* Bytes of the raw P6 rows in buffers, written out by one IO_write_ppm_rows */
+static size_t raw_row_bytes(Compress40_buffers buffers, A2Methods_T methods)
+{
+    return (size_t) methods->width(buffers->rows) * 3 * BLOCKSIZE;
+}
+
+/*
+ * Compress40_buffers_new
+ *
+ * Create empty row buffers. They are sized by the first image they are used
+ * with.
+ *
+ * @return Compress40_buffers - Buffers to be freed with Compress40_buffers_free
+ */
+Compress40_buffers Compress40_buffers_new(void)
+{
+    Compress40_buffers buffers;
+    NEW(buffers);
+    buffers->rows = NULL;
+    buffers->word = NULL;
+    buffers->raw = NULL;
+
+    return buffers;
+}
+
+/*
+ * Compress40_buffers_free
+ *
+ * Free row buffers and the arrays they hold.
+ *
+ * @param Compress40_buffers *buffers - Buffers to be freed
+ *
+ * @expect                            - An error is raised if buffers or
+ *                                      *buffers is null
+ */
+void Compress40_buffers_free(Compress40_buffers *buffers)
+{
+    assert(buffers != NULL && *buffers != NULL);
+
+    release_buffers(*buffers, uarray2_methods_plain);
+    FREE(*buffers);
+}
+
 /*
  * compress40
  *
  * Compress an input image from the given input stream and print to stdout 
- * as bytes in big Endian order.
+ * as bytes in big Endian order. See compress40_image.
  *
  * @param FILE *input - Input stream can be stdin or file input
- * 
- * @expect            - A2Method_T function pointers are not null;
- *                      specifically, methods->free
- * @expect            - Functions in the Transform module always return a new
- *                      2D array
  */
 void compress40(FILE *input)
+{
+    compress40_image(input, stdout);
+}
+
+/*
+ * compress_gray
+ *
+ * Compress the rest of a PGM image whose header has been read. Each 2 x 2
+ * block becomes a GRAY_CODE_LENGTH-bit luma-only codeword under the
+ * grayscale header; none of the chroma steps run. Rows are read two at a
+ * time, so memory stays O(width) as in compress40_stream, unless every
+ * sample has already been loaded into raw.
+ *
+ * @param FILE *input          - Input stream positioned at the samples
+ * @param FILE *output         - Stream the compressed image is written to
+ * @param IO_ppm_header header - Header read from input
+ * @param IO_raw_ppm *raw      - Samples loaded with IO_load_raw_ppm, or
+ *                               NULL to read them from input
+ */
+static void compress_gray(FILE *input, FILE *output, IO_ppm_header header,
+                          IO_raw_ppm *raw)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(header.channels == 1);
+
+    unsigned width = Formulas_get_even(header.width);
+    unsigned height = Formulas_get_even(header.height);
+    IO_write_gray_header(output, width, height);
+
+    /* The sample row keeps the odd column so each row is read whole */
+    float *table = Transform_normal_table(header.denominator);
+    int bytes = header.denominator > 255 ? 2 : 1;
+    unsigned char *samples = ALLOC((size_t) header.width * bytes + 1);
+    float *top = CALLOC((size_t) width * BLOCKSIZE + 1, sizeof(float));
+    float *bottom = top + width;
+
+    A2Methods_UArray2 word = methods->new(width / BLOCKSIZE, 1,
+                                          sizeof(uint64_t));
+    for (unsigned row = 0; row < height; row += BLOCKSIZE) {
+        if (raw != NULL) {
+            const unsigned char *upper = raw->pixels + row * raw->stride;
+            Transform_normalize_row(upper, width, bytes, table, top);
+            Transform_normalize_row(upper + raw->stride, width, bytes, table,
+                                    bottom);
+            IO_consume(&raw->mapping, upper + BLOCKSIZE * raw->stride);
+        } else {
+            IO_read_gray_row(input, header, samples);
+            Transform_normalize_row(samples, width, bytes, table, top);
+            IO_read_gray_row(input, header, samples);
+            Transform_normalize_row(samples, width, bytes, table, bottom);
+        }
+        for (unsigned col = 0; col < width; col += BLOCKSIZE) {
+            uint64_t *cell = methods->at(word, col / BLOCKSIZE, 0);
+            *cell = Transform_encode_gray(top, bottom, col);
+        }
+        IO_write_words(output, word, methods, GRAY_CODE_LENGTH);
+    }
+
+    methods->free(&word);
+    FREE(top);
+    FREE(samples);
+    FREE(table);
+}
+
+/*
+ * compress_rows
+ *
+ * Compress the rest of an image whose header has been read, two pixel rows
+ * at a time through the BLOCKSIZE-row buffer of buffers. A PGM goes to
+ * compress_gray instead.
+ *
+ * @param FILE *input                - Input stream positioned at the samples
+ * @param FILE *output               - Stream the compressed image is written
+ *                                     to
+ * @param IO_ppm_header header       - Header read from input
+ * @param Compress40_buffers buffers - Row buffers kept between calls; NULL
+ *                                     to use temporary ones
+ */
+static void compress_rows(FILE *input, FILE *output, IO_ppm_header header,
+                          Compress40_buffers buffers)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    if (header.channels == 1) {
+        compress_gray(input, output, header, NULL);
+        return;
+    }
+
+    unsigned width = Formulas_get_even(header.width);
+    unsigned height = Formulas_get_even(header.height);
+    IO_write_header(output, width, height);
+
+    /* The row buffer keeps the odd column so each row is read whole */
+    struct Compress40_buffers temporary = {NULL, NULL, NULL};
+    Compress40_buffers b = buffers != NULL ? buffers : &temporary;
+    fit_buffers(b, methods, header.width, width / BLOCKSIZE);
+
+    for (unsigned row = 0; row < height; row += BLOCKSIZE) {
+        for (int j = 0; j < BLOCKSIZE; j++) {
+            IO_read_ppm_row(input, header, b->rows, methods, j);
+        }
+        encode_row(b->rows, 0, b->word, 0, methods, header.denominator);
+        IO_write_words(output, b->word, methods, CODE_LENGTH);
+    }
+
+    if (buffers == NULL) {
+        release_buffers(b, methods);
+    }
+}
+
+/*
+ * encode_raw
+ *
+ * Pack the samples of an RGB image loaded with IO_read_raw_ppm and write
+ * them to output, as compress40_tiled describes. raw is freed.
+ *
+ * @param IO_raw_ppm *raw - Samples of the image
+ * @param FILE *output    - Stream the compressed image is written to
+ * @param unsigned tile   - Blocks per side of a tile, or 0 for format 2
+ */
+static void encode_raw(IO_raw_ppm *raw, FILE *output, unsigned tile)
+{
+    IO_ppm_header header = raw->header;
+    unsigned width = Formulas_get_even(header.width);
+    unsigned height = Formulas_get_even(header.height);
+
+    /* Tiles and pipes take every codeword at once, the rest a row at a time */
+    int whole = tile > 0 || IO_is_pipe(output);
+    size_t row_bytes = (size_t) (width / BLOCKSIZE)
+                       * (CODE_LENGTH / CHAR_BIT);
+    unsigned char *words = whole ? IO_new_output(row_bytes
+                                                 * (height / BLOCKSIZE))
+                                 : ALLOC(row_bytes + 1);
+    if (!whole) {
+        IO_write_header(output, width, height);
+    }
+
+    /* Each pair of rows is normalized by lookup before it is packed */
+    float *table = Transform_normal_table(header.denominator);
+    int bytes = header.denominator > 255 ? 2 : 1;
+    float *top = CALLOC((size_t) width * 3 * BLOCKSIZE + 1, sizeof(float));
+    float *bottom = top + (size_t) width * 3;
+
+    for (unsigned row = 0; row < height; row += BLOCKSIZE) {
+        const unsigned char *samples = raw->pixels + row * raw->stride;
+        Transform_normalize_row(samples, width * 3, bytes, table, top);
+        Transform_normalize_row(samples + raw->stride, width * 3, bytes,
+                                table, bottom);
+        unsigned char *row_words = whole ? words + row / BLOCKSIZE * row_bytes
+                                         : words;
+        for (unsigned col = 0; col < width; col += BLOCKSIZE) {
+            IO_put_word(row_words, col / BLOCKSIZE,
+                        Transform_encode_normal(top, bottom, col),
+                        CODE_LENGTH);
+        }
+        if (!whole) {
+            size_t written = fwrite(words, 1, row_bytes, output);
+            assert(written == row_bytes);
+        }
+        IO_consume(&raw->mapping, samples + BLOCKSIZE * raw->stride);
+    }
+
+    if (whole) {
+        IO_send_binary(output, width, height, words, BLOCKSIZE, CODE_LENGTH,
+                       tile);
+    } else {
+        FREE(words);
+    }
+    FREE(top);
+    FREE(table);
+    IO_free_raw_ppm(raw);
+}
+
+/*
+ * compress40_image
+ *
+ * Compress an input image into format 2. See compress40_tiled.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ */
+void compress40_image(FILE *input, FILE *output)
+{
+    compress40_tiled(input, output, 0);
+}
+
+/*
+ * compress40_tiled
+ *
+ * Compress an input image from the given input stream and write it to the
+ * output stream as bytes in big Endian order. The samples of a P6 image are
+ * mapped (or read in one piece from a pipe). Each pair of rows is normalized
+ * by table lookup, 8- or 16-bit alike, and packed with
+ * Transform_encode_normal, so no Pnm_rgb array is built, no sample is
+ * divided, and an odd last row or column is simply never read. The text of
+ * a P3 image is parsed into the same layout first, so it takes the same path.
+ * Codewords are written a row at a time, except into a pipe or as tiles,
+ * which are handed the whole compressed image with IO_send_binary.
+ *
+ * @param FILE *input   - Input stream can be stdin or file input
+ * @param FILE *output  - Stream the compressed image is written to
+ * @param unsigned tile - Blocks per side of the tiles of format 3, or 0 for
+ *                        format 2. A PGM is always written in the grayscale
+ *                        format 2.
+ */
+void compress40_tiled(FILE *input, FILE *output, unsigned tile)
+{
+    IO_ppm_header header = IO_read_ppm_header(input);
+    if (header.channels != 3) {
+        /* A PGM goes on to compress_gray */
+        compress_rows(input, output, header, NULL);
+        return;
+    }
+
+    IO_raw_ppm raw = IO_read_raw_ppm(input, header);
+    encode_raw(&raw, output, tile);
+}
+
+/*
+ * compress40_stream
+ *
+ * Compress an input image from the given input stream two rows at a time.
+ * Only the PPM header is parsed up front; each pair of pixel rows is read
+ * into the same BLOCKSIZE-row buffer, packed into one row of codewords, and
+ * written before the next pair is read. Memory stays O(width) and the output
+ * is identical to compress40.
+ *
+ * @param FILE *input                  - Input stream can be stdin or file
+ *                                       input
+ * @param FILE *output                 - Stream the compressed image is 
+ *                                       written to
+ * @param Compress40_buffers buffers   - Row buffers kept between calls; NULL
+ *                                       to use temporary ones
+ *
+ * @expect                             - A2Method_T function pointers are not
+ *                                       null; specifically, methods->free
+ */
+void compress40_stream(FILE *input, FILE *output,
+                       Compress40_buffers buffers)
 {
     A2Methods_T methods = uarray2_methods_plain;
     assert(methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
     assert(methods->free != NULL);
-    
-    /* Read input image */
-    Pnm_ppm pixmap = IO_read_plain_image(input, methods); 
+
+    IO_ppm_header header = IO_read_ppm_header(input);
+    compress_rows(input, output, header, buffers);
+}
+
+/*
+ * decode_band
+ *
+ * Thread entry point of decompress40_parallel. Each codeword row starts at a
+ * fixed offset in the payload and each pixel row at a fixed offset in the
+ * output, so a band is decoded without looking at the others. Rows go to
+ * the shared pixels buffer, or when it is NULL are written to output with
+ * IO_write_at.
+ *
+ * @param void *cl - Pointer to struct Band
+ * @return void *  - Always NULL
+ */
+static void *decode_band(void *cl)
+{
+    Band band = cl;
+    size_t row_bytes = band->stride * BLOCKSIZE;
+
+    /* Without a shared buffer, rows are decoded a chunk at a time */
+    int rows = band->last - band->first;
+    unsigned char *chunk = NULL;
+    if (band->pixels == NULL) {
+        rows = row_bytes > 0 && row_bytes < BAND_CHUNK
+               ? BAND_CHUNK / row_bytes : 1;
+        chunk = ALLOC(row_bytes * rows + 1);
+    }
+
+    for (int j = band->first; j < band->last; j += rows) {
+        int last = j + rows < band->last ? j + rows : band->last;
+        unsigned char *top = chunk != NULL ? chunk
+                             : band->pixels + (size_t) j * row_bytes;
+        for (int row = j; row < last; row++, top += row_bytes) {
+            for (int col = 0; col < band->width; col++) {
+                size_t index = (size_t) row * band->width + col;
+                uint64_t word = IO_get_word(band->payload, index,
+                                            CODE_LENGTH);
+                Transform_decode_raw(word, top, top + band->stride,
+                                     col * BLOCKSIZE, band->denominator);
+            }
+        }
+        if (chunk != NULL) {
+            IO_write_at(band->output, chunk, row_bytes * (last - j),
+                        band->offset + (off_t) row_bytes * j);
+        }
+    }
+    FREE(chunk);
+
+    return NULL;
+}
+
+/*
+ * run_bands
+ *
+ * Run a thread per band over block rows [0, height) and wait for all of them.
+ *
+ * @param struct Band proto   - Fields shared by every band; first and last
+ *                              are filled in here
+ * @param int height          - Number of block rows
+ * @param unsigned threads    - Number of bands
+ * @param void *(*work)(void *) - encode_band or decode_band
+ *
+ * @expect                    - An error is raised if a thread cannot be
+ *                              created
+ */
+static void run_bands(struct Band proto, int height, unsigned threads,
+                      void *(*work)(void *))
+{
+    struct Band *bands = CALLOC(threads, sizeof(struct Band));
+    pthread_t *tids = CALLOC(threads, sizeof(pthread_t));
+    int per_band = (height + threads - 1) / threads;
+
+    for (unsigned t = 0; t < threads; t++) {
+        int first = t * per_band;
+        bands[t] = proto;
+        bands[t].first = first < height ? first : height;
+        bands[t].last = first + per_band < height ? first + per_band : height;
+        int created = pthread_create(&tids[t], NULL, work, &bands[t]);
+        assert(created == 0);
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    FREE(tids);
+    FREE(bands);
+}
+
+/*
+ * compress40_parallel
+ *
+ * Compress an input image from the given input stream using several threads.
+ * The codeword array is split into horizontal bands of block rows, one band
+ * per thread. When output is a regular file every codeword's offset is known
+ * from the header alone, so each thread writes its band straight to its
+ * place in the file with pwrite and no thread waits on another. Otherwise
+ * the codewords are written in order once every band is packed. Either way
+ * the output is identical to compress40.
+ *
+ * @param FILE *input      - Input stream can be stdin or file input
+ * @param FILE *output     - Stream the compressed image is written to
+ * @param unsigned threads - Number of threads to use
+ *
+ * @expect                 - An error is raised if threads is 0 or a thread
+ *                           cannot be created
+ */
+void compress40_parallel(FILE *input, FILE *output, unsigned threads)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->free != NULL);
+    assert(threads > 0);
+
+    IO_ppm_header header = IO_read_ppm_header(input);
+    if (header.channels == 1) {
+        /* A PGM streams through compress_gray on the calling thread */
+        compress_gray(input, output, header, NULL);
+        return;
+    }
+    Pnm_ppm pixmap = IO_read_plain_image(input, header, methods);
+    int width = pixmap->width / BLOCKSIZE;
+    int height = pixmap->height / BLOCKSIZE;
+    IO_write_header(output, pixmap->width, pixmap->height);
+
+    struct Band band = {
+        .image = pixmap->pixels, .word = NULL, .payload = NULL,
+        .pixels = NULL, .width = width, .methods = methods,
+        .denominator = pixmap->denominator, .output = output,
+        .offset = IO_positional_start(output)
+    };
+    if (band.offset >= 0) {
+        off_t nbytes = (off_t) width * height * (CODE_LENGTH / CHAR_BIT);
+        IO_reserve(output, band.offset + nbytes);
+        run_bands(band, height, threads, encode_band);
+        IO_positional_end(output, band.offset + nbytes);
+    } else {
+        band.word = methods->new(width, height, sizeof(uint64_t));
+        run_bands(band, height, threads, encode_band);
+        IO_write_words(output, band.word, methods, CODE_LENGTH);
+        methods->free(&band.word);
+    }
+
+    Pnm_ppmfree(&pixmap);
+}
+
+/* Number of row pairs in flight between the stages of a pipeline */
+#define PIPELINE_DEPTH 8
+
+/*
+ * struct Pipeline
+ *
+ * State shared by the three stages of compress40_pipeline and
+ * decompress40_pipeline. Each slot is a struct Compress40_buffers holding one
+ * BLOCKSIZE-row pixel buffer and one row of codewords. Slots go round from
+ * the reader to the transformer to the writer and back to the reader, one
+ * ring between each pair of stages; a NULL slot marks the end of the image.
+ *
+ * @field FILE *input, *output     - Streams of the image
+ * @field IO_ppm_header header     - Header of the PPM input when compressing
+ * @field A2Methods_T methods      - Methods to interact with the slots
+ * @field unsigned denominator     - Denominator of the pixels in the slots
+ * @field unsigned rows            - Number of block rows
+ * @field int decompress           - Nonzero when decompressing
+ * @field Ring_T free, read, coded - Empty slots (writer to reader), slots
+ *                                   read (reader to transformer), and slots
+ *                                   transformed (transformer to writer)
+ */
+typedef struct Pipeline {
+    FILE *input, *output;
+    IO_ppm_header header;
+    A2Methods_T methods;
+    unsigned denominator, rows;
+    int decompress;
+    Ring_T free, read, coded;
+} *Pipeline;
+
+/*
+ * read_stage
+ *
+ * Reader thread of a pipeline. Fills empty slots from the input: BLOCKSIZE
+ * pixel rows when compressing, one row of codewords when decompressing.
+ *
+ * @param void *cl - Pointer to struct Pipeline
+ * @return void *  - Always NULL
+ */
+static void *read_stage(void *cl)
+{
+    Pipeline p = cl;
+    for (unsigned row = 0; row < p->rows; row++) {
+        Compress40_buffers slot = Ring_get(p->free);
+        if (p->decompress) {
+            IO_read_words(p->input, slot->word, p->methods, CODE_LENGTH);
+        } else {
+            for (int j = 0; j < BLOCKSIZE; j++) {
+                IO_read_ppm_row(p->input, p->header, slot->rows, p->methods,
+                                j);
+            }
+        }
+        Ring_put(p->read, slot);
+    }
+    Ring_put(p->read, NULL);
+
+    return NULL;
+}
+
+/*
+ * transform_stage
+ *
+ * Transformer thread of a pipeline. Packs the pixels of each slot into its
+ * codewords, or unpacks the codewords into its pixels.
+ *
+ * @param void *cl - Pointer to struct Pipeline
+ * @return void *  - Always NULL
+ */
+static void *transform_stage(void *cl)
+{
+    Pipeline p = cl;
+    Compress40_buffers slot;
+    while ((slot = Ring_get(p->read)) != NULL) {
+        if (p->decompress) {
+            decode_row(slot, p->methods);
+        } else {
+            encode_row(slot->rows, 0, slot->word, 0, p->methods,
+                       p->denominator);
+        }
+        Ring_put(p->coded, slot);
+    }
+    Ring_put(p->coded, NULL);
+
+    return NULL;
+}
+
+/*
+ * run_pipeline
+ *
+ * Run the reader and transformer on their own threads while the calling
+ * thread writes each slot in order. The headers must already be handled.
+ *
+ * @param Pipeline p - Pipeline whose rings are filled in here
+ * @param int width  - Number of pixels per row of a slot
+ *
+ * @expect           - An error is raised if a thread cannot be created
+ */
+static void run_pipeline(Pipeline p, int width)
+{
+    /* Each ring can hold every slot and the end marker */
+    struct Compress40_buffers slots[PIPELINE_DEPTH];
+    p->free = Ring_new(PIPELINE_DEPTH + 1);
+    p->read = Ring_new(PIPELINE_DEPTH + 1);
+    p->coded = Ring_new(PIPELINE_DEPTH + 1);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        slots[i].rows = NULL;
+        slots[i].word = NULL;
+        slots[i].raw = NULL;
+        fit_buffers(&slots[i], p->methods, width,
+                    Formulas_get_even(width) / BLOCKSIZE);
+        Ring_put(p->free, &slots[i]);
+    }
+
+    pthread_t reader, transformer;
+    int created = pthread_create(&reader, NULL, read_stage, p);
+    assert(created == 0);
+    created = pthread_create(&transformer, NULL, transform_stage, p);
+    assert(created == 0);
+
+    Compress40_buffers slot;
+    while ((slot = Ring_get(p->coded)) != NULL) {
+        if (p->decompress) {
+            IO_write_ppm_rows(p->output, slot->raw,
+                              raw_row_bytes(slot, p->methods));
+        } else {
+            IO_write_words(p->output, slot->word, p->methods, CODE_LENGTH);
+        }
+        Ring_put(p->free, slot);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(transformer, NULL);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        release_buffers(&slots[i], p->methods);
+    }
+    Ring_free(&p->free);
+    Ring_free(&p->read);
+    Ring_free(&p->coded);
+}
+
+/*
+ * compress40_pipeline
+ *
+ * Compress an input image from the given input stream with reading, packing,
+ * and writing overlapped. A reader thread reads pairs of pixel rows, a
+ * transformer thread packs them, and the calling thread writes each row of
+ * codewords, so disk I/O and computation run at the same time. At most
+ * PIPELINE_DEPTH row pairs are in flight, so memory stays O(width) and the
+ * output is identical to compress40.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ *
+ * @expect             - An error is raised if a thread cannot be created
+ */
+void compress40_pipeline(FILE *input, FILE *output)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
+    assert(methods->free != NULL);
+
+    IO_ppm_header header = IO_read_ppm_header(input);
+    if (header.channels == 1) {
+        compress_gray(input, output, header, NULL);
+        return;
+    }
+    unsigned width = Formulas_get_even(header.width);
+    unsigned height = Formulas_get_even(header.height);
+    IO_write_header(output, width, height);
+
+    struct Pipeline pipeline = {
+        .input = input, .output = output, .header = header,
+        .methods = methods, .denominator = header.denominator,
+        .rows = height / BLOCKSIZE, .decompress = 0
+    };
+    run_pipeline(&pipeline, header.width);
+}
+
+/*
+ * encode_staged
+ *
+ * Run every Transform step of compress40_staged over an image that has been
+ * read, and write its codewords to output. pixmap is freed.
+ *
+ * @param Pnm_ppm pixmap - Image with even dimensions
+ * @param FILE *output   - Stream the compressed image is written to
+ */
+static void encode_staged(Pnm_ppm pixmap, FILE *output)
+{
+    A2Methods_T methods = pixmap->methods;
 
     /* Normalize rgb */
     A2Methods_UArray2 image = pixmap->pixels;
@@ -56,32 +876,380 @@ void compress40(FILE *input)
     A2Methods_UArray2 word = Transform_dct_to_word(quantized, methods);
     methods->free(&quantized);
 
-    IO_write_binary(stdout, word, methods, BLOCKSIZE, CODE_LENGTH);
+    IO_write_binary(output, word, methods, BLOCKSIZE, CODE_LENGTH);
     methods->free(&word);
     Pnm_ppmfree(&pixmap);
 }
 
+/*
+ * compress40_staged
+ *
+ * Compress an input image from the given input stream and write it to the
+ * output stream as bytes in big Endian order. Every Transform step builds a
+ * full-size array; this is the reference path for compress40.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ * 
+ * @expect            - A2Method_T function pointers are not null;
+ *                      specifically, methods->free
+ * @expect            - Functions in the Transform module always return a new
+ *                      2D array
+ */
+void compress40_staged(FILE *input, FILE *output)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->free != NULL);
+    
+    /* A PGM has no chroma for the staged steps; it goes to compress_gray */
+    IO_ppm_header header = IO_read_ppm_header(input);
+    if (header.channels == 1) {
+        compress_gray(input, output, header, NULL);
+        return;
+    }
+
+    /* Read input image */
+    Pnm_ppm pixmap = IO_read_plain_image(input, header, methods);
+    encode_staged(pixmap, output);
+}
+
+/*
+ * decode_gray
+ *
+ * Decode the 24-bit codewords of a grayscale image from payload and write
+ * them out as a P5 image with DENOMINATOR.
+ *
+ * @param const unsigned char *payload - Codewords following the header
+ * @param FILE *output                 - Stream the PGM image is written to
+ * @param unsigned width               - Width from the header
+ * @param unsigned height              - Height from the header
+ */
+static void decode_gray(const unsigned char *payload, FILE *output,
+                        unsigned width, unsigned height)
+{
+    width = width / BLOCKSIZE;
+    height = height / BLOCKSIZE;
+    size_t stride = (size_t) width * BLOCKSIZE;
+    unsigned char *pixels = IO_new_output(stride * height * BLOCKSIZE);
+    size_t index = 0;
+    for (unsigned j = 0; j < height; j++) {
+        unsigned char *top = pixels + (size_t) j * BLOCKSIZE * stride;
+        for (unsigned i = 0; i < width; i++) {
+            uint64_t word = IO_get_word(payload, index++, GRAY_CODE_LENGTH);
+            Transform_decode_gray(word, top, top + stride, i * BLOCKSIZE,
+                                  DENOMINATOR);
+        }
+    }
+
+    IO_ppm_header header = {
+        .width = width * BLOCKSIZE, .height = height * BLOCKSIZE,
+        .denominator = DENOMINATOR, .channels = 1, .format = '5'
+    };
+    IO_send_raw_ppm(output, header, pixels);
+}
+
+/*
+ * decompress_gray
+ *
+ * Decompress the rest of a grayscale image whose header has been read into
+ * a P5 image with DENOMINATOR.
+ *
+ * @param FILE *input     - Input stream positioned at the codewords
+ * @param FILE *output    - Stream the PGM image is written to
+ * @param unsigned width  - Width from the header
+ * @param unsigned height - Height from the header
+ */
+static void decompress_gray(FILE *input, FILE *output, unsigned width,
+                            unsigned height)
+{
+    size_t nbytes = (size_t) (width / BLOCKSIZE) * (height / BLOCKSIZE)
+                    * (GRAY_CODE_LENGTH / CHAR_BIT);
+    unsigned char *payload = IO_read_payload(input, nbytes);
+    decode_gray(payload, output, width, height);
+    FREE(payload);
+}
+
+/*
+ * decode_rows
+ *
+ * Decode the codewords of an RGB image from payload one row at a time
+ * straight into BLOCKSIZE rows of raw P6 samples, writing them with one
+ * fwrite as each row is done.
+ *
+ * @param const unsigned char *payload - Codewords following the header
+ * @param IO_mapping *mapping          - Mapping payload lies in, told as
+ *                                       each row is done; NULL if it is not
+ *                                       mapped
+ * @param FILE *output                 - Stream the PPM image is written to
+ * @param unsigned width               - Width from the header
+ * @param unsigned height              - Height from the header
+ * @param Compress40_buffers buffers   - Row buffers kept between calls; NULL
+ *                                       to use temporary ones
+ */
+static void decode_rows(const unsigned char *payload, IO_mapping *mapping,
+                        FILE *output, unsigned width, unsigned height,
+                        Compress40_buffers buffers)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    width = width / BLOCKSIZE * BLOCKSIZE;
+    height = height / BLOCKSIZE * BLOCKSIZE;
+    IO_write_ppm_header(output, width, height, DENOMINATOR);
+
+    struct Compress40_buffers temporary = {NULL, NULL, NULL};
+    Compress40_buffers b = buffers != NULL ? buffers : &temporary;
+    fit_buffers(b, methods, width, width / BLOCKSIZE);
+
+    size_t stride = (size_t) width * 3;
+    size_t index = 0;
+    for (unsigned row = 0; row < height; row += BLOCKSIZE) {
+        for (unsigned col = 0; col < width; col += BLOCKSIZE) {
+            uint64_t word = IO_get_word(payload, index++, CODE_LENGTH);
+            Transform_decode_raw(word, b->raw, b->raw + stride, col,
+                                 DENOMINATOR);
+        }
+        IO_write_ppm_rows(output, b->raw, stride * BLOCKSIZE);
+        if (mapping != NULL) {
+            IO_consume(mapping, payload + index * (CODE_LENGTH / CHAR_BIT));
+        }
+    }
+
+    if (buffers == NULL) {
+        release_buffers(b, methods);
+    }
+}
+
+/*
+ * decompress_tiled
+ *
+ * Decompress the rest of a tiled image whose header has been read. The
+ * tiles are gathered back into row-major codewords, which are decoded as
+ * those of a mapped file are.
+ *
+ * @param FILE *input               - Input stream positioned at the index
+ * @param FILE *output              - Stream the PPM image is written to
+ * @param IO_binary_header header   - Header that was read
+ */
+static void decompress_tiled(FILE *input, FILE *output,
+                             IO_binary_header header)
+{
+    unsigned char *payload = IO_read_tiled(input, header, BLOCKSIZE,
+                                           CODE_LENGTH);
+    decode_rows(payload, NULL, output, header.width, header.height,
+                NULL);
+    FREE(payload);
+}
+
+/*
+ * read_header
+ *
+ * Read the header of a compressed image. A grayscale or tiled image is
+ * decompressed right away with decompress_gray or decompress_tiled, so every
+ * decompressor handles all of them.
+ *
+ * @param FILE *input       - Input stream can be stdin or file input
+ * @param FILE *output      - Stream the image is written to
+ * @param unsigned *width   - Set to the width from the header
+ * @param unsigned *height  - Set to the height from the header
+ * @return int              - 1 if the image was grayscale or tiled and is
+ *                            done, otherwise 0
+ */
+static int read_header(FILE *input, FILE *output, unsigned *width,
+                       unsigned *height)
+{
+    IO_binary_header header;
+    IO_read_header(input, &header);
+    *width = header.width;
+    *height = header.height;
+    if (header.gray) {
+        decompress_gray(input, output, *width, *height);
+        return 1;
+    }
+    if (header.tile > 0) {
+        decompress_tiled(input, output, header);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * raw_ppm_header
+ *
+ * Header of a P6 output image of DENOMINATOR.
+ */
+static IO_ppm_header raw_ppm_header(unsigned width, unsigned height)
+{
+    IO_ppm_header header = {
+        .width = width, .height = height, .denominator = DENOMINATOR,
+        .channels = 3, .format = '6'
+    };
+
+    return header;
+}
+
 /*
  * decompress40
  *
  * Decompress an image from the given input stream. The decompressed image 
- * is printed to stdout in binary.
+ * is printed to stdout in binary. See decompress40_image.
  *
- * @param FILE *input - Input stream can be stdin or file input; specifically
- *                      and methods->new, methods->free, methods->width, and
- *                      methods->height
- *
- * @expect            - A2Methods_T function pointers are not null
+ * @param FILE *input - Input stream can be stdin or file input
  */
 void decompress40(FILE *input)
+{
+    decompress40_image(input, stdout);
+}
+
+/*
+ * decompress40_image
+ *
+ * Decompress an image from the given input stream and write it to the output
+ * stream in binary. Each codeword is written to its 2 x 2 block of a buffer
+ * laid out as the P6 body in a single pass with Transform_decode_raw, and
+ * the header and buffer go out together with IO_send_raw_ppm, which hands
+ * the buffer's pages straight to a pipe.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ *
+ * @expect             - A2Methods_T function pointers are not null;
+ *                       specifically methods->new, methods->free, 
+ *                       methods->width, and methods->height
+ */
+void decompress40_image(FILE *input, FILE *output)
 {
     A2Methods_T methods = uarray2_methods_plain;
     assert(methods != NULL);
 
+    unsigned width = 0, height = 0;
+    if (read_header(input, output, &width, &height)) {
+        return;
+    }
+
     /* Codeword stored in 2D array is represented by 64 bits integer */
-    A2Methods_UArray2 word = IO_read_binary(input, methods, BLOCKSIZE,
-                                            CODE_LENGTH);
+    A2Methods_UArray2 word = methods->new(width / BLOCKSIZE,
+                                          height / BLOCKSIZE,
+                                          sizeof(uint64_t));
+    IO_read_words(input, word, methods, CODE_LENGTH);
+    width = methods->width(word);
+    height = methods->height(word);
+    size_t stride = (size_t) width * BLOCKSIZE * 3;
+    unsigned char *pixels = IO_new_output(stride * height * BLOCKSIZE);
+
+    for (unsigned j = 0; j < height; j++) {
+        unsigned char *top = pixels + (size_t) j * BLOCKSIZE * stride;
+        for (unsigned i = 0; i < width; i++) {
+            uint64_t *cell = methods->at(word, i, j);
+            Transform_decode_raw(*cell, top, top + stride, i * BLOCKSIZE,
+                                 DENOMINATOR);
+        }
+    }
+    methods->free(&word);
+
+    IO_send_raw_ppm(output, raw_ppm_header(width * BLOCKSIZE,
+                                           height * BLOCKSIZE), pixels);
+}
 
+/*
+ * decompress40_stream
+ *
+ * Decompress an image from the given input stream one row of codewords at a
+ * time. Each row is decoded into BLOCKSIZE rows of raw P6 samples and
+ * written with one fwrite before the next row is read, so memory stays
+ * O(width) and output starts after the first row. The output is identical
+ * to decompress40.
+ *
+ * @param FILE *input                  - Input stream can be stdin or file
+ *                                       input
+ * @param FILE *output                 - Stream the PPM image is written to
+ * @param Compress40_buffers buffers   - Row buffers kept between calls; NULL
+ *                                       to use temporary ones
+ *
+ * @expect                             - A2Methods_T function pointers are
+ *                                       not null
+ */
+void decompress40_stream(FILE *input, FILE *output,
+                         Compress40_buffers buffers)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
+    assert(methods->free != NULL);
+
+    unsigned width = 0, height = 0;
+    if (read_header(input, output, &width, &height)) {
+        return;
+    }
+    width = width / BLOCKSIZE * BLOCKSIZE;
+    height = height / BLOCKSIZE * BLOCKSIZE;
+    IO_write_ppm_header(output, width, height, DENOMINATOR);
+
+    struct Compress40_buffers temporary = {NULL, NULL, NULL};
+    Compress40_buffers b = buffers != NULL ? buffers : &temporary;
+    fit_buffers(b, methods, width, width / BLOCKSIZE);
+
+    for (unsigned row = 0; row < height; row += BLOCKSIZE) {
+        IO_read_words(input, b->word, methods, CODE_LENGTH);
+        decode_row(b, methods);
+        IO_write_ppm_rows(output, b->raw, raw_row_bytes(b, methods));
+    }
+
+    if (buffers == NULL) {
+        release_buffers(b, methods);
+    }
+}
+
+/*
+ * decompress40_mapped
+ *
+ * Decompress an image from the given input stream by mapping the file into
+ * memory and decoding each row of codewords in place, with no copy through
+ * stdio. Rows are decoded and written one at a time as in
+ * decompress40_stream, which is used instead when the input cannot be
+ * mapped (e.g. a pipe). The output is identical to decompress40.
+ *
+ * @param FILE *input                  - Input stream can be stdin or file
+ *                                       input
+ * @param FILE *output                 - Stream the PPM image is written to
+ * @param Compress40_buffers buffers   - Row buffers kept between calls; NULL
+ *                                       to use temporary ones
+ *
+ * @expect                             - A2Methods_T function pointers are
+ *                                       not null
+ */
+void decompress40_mapped(FILE *input, FILE *output,
+                         Compress40_buffers buffers)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
+    assert(methods->free != NULL);
+
+    IO_binary_map map;
+    if (!IO_map_binary(input, &map, BLOCKSIZE, CODE_LENGTH)) {
+        decompress40_stream(input, output, buffers);
+        return;
+    }
+
+    decode_rows(map.payload, &map.mapping, output, map.width, map.height,
+                buffers);
+    IO_unmap_binary(&map);
+}
+
+/*
+ * decode_staged
+ *
+ * Run every Transform step of decompress40_staged over the codewords of an
+ * image and write it to output as a P6 image. word is freed.
+ *
+ * @param A2Methods_UArray2 word - Codewords, one per 2 x 2 block
+ * @param A2Methods_T methods    - Methods word was allocated with
+ * @param FILE *output           - Stream the PPM image is written to
+ */
+static void decode_staged(A2Methods_UArray2 word, A2Methods_T methods,
+                          FILE *output)
+{
     /* Extract quantized field from codeword */
     A2Methods_UArray2 dct = Transform_word_to_dct(word, methods);
     methods->free(&word);
@@ -107,6 +1275,407 @@ void decompress40(FILE *input)
     pixmap->methods = methods;
     pixmap->pixels = rgb;
 
-    Pnm_ppmwrite(stdout, pixmap);
+    Pnm_ppmwrite(output, pixmap);
     Pnm_ppmfree(&pixmap);
+}
+
+/*
+ * check_compressed
+ *
+ * Check that data holds a header followed by every codeword it promises, or
+ * for a tiled image by a valid index and every tile, without raising.
+ *
+ * @param const unsigned char *data - Compressed image
+ * @param size_t size               - Number of bytes at data
+ * @param IO_binary_header *header  - Set to the header of the image
+ * @param uint64_t **offsets        - Set to the index of a tiled image, to be
+ *                                    freed with FREE, or NULL
+ * @return int                      - 1 if the image is whole, otherwise 0
+ */
+static int check_compressed(const unsigned char *data, size_t size,
+                            IO_binary_header *header, uint64_t **offsets)
+{
+    *offsets = NULL;
+    if (!IO_parse_header(data, size, header)) {
+        return 0;
+    }
+
+    const unsigned char *payload = data + header->offset;
+    size_t available = size - header->offset;
+    if (header->tile > 0) {
+        *offsets = IO_check_index(payload, available, *header, BLOCKSIZE,
+                                  CODE_LENGTH);
+        return *offsets != NULL;
+    }
+
+    /* Divided rather than multiplied, so no header can overflow the count */
+    int code_length = header->gray ? GRAY_CODE_LENGTH : CODE_LENGTH;
+    size_t words = available / (code_length / CHAR_BIT);
+    size_t columns = header->width / BLOCKSIZE;
+    return columns == 0 || words / columns >= header->height / BLOCKSIZE;
+}
+
+/*
+ * decode_memory
+ *
+ * Decompress an image held in memory that check_compressed has accepted. A
+ * grayscale image is written as a P5 image, and the tiles of a tiled image
+ * are gathered back into rows first.
+ *
+ * @param const unsigned char *data  - Compressed image
+ * @param IO_binary_header header    - Header set by check_compressed
+ * @param const uint64_t *offsets    - Index set by check_compressed
+ * @param IO_mapping *mapping        - Mapping data lies in, or NULL
+ * @param FILE *output               - Stream the image is written to
+ * @param Compress40_buffers buffers - Row buffers kept between calls; NULL
+ *                                     to use temporary ones
+ * @param int staged                 - Nonzero to decode the codewords of an
+ *                                     RGB format 2 image as
+ *                                     decompress40_staged does
+ */
+static void decode_memory(const unsigned char *data, IO_binary_header header,
+                          const uint64_t *offsets, IO_mapping *mapping,
+                          FILE *output, Compress40_buffers buffers,
+                          int staged)
+{
+    const unsigned char *payload = data + header.offset;
+    if (header.tile > 0) {
+        unsigned char *words = IO_untile(payload, offsets, header, BLOCKSIZE,
+                                         CODE_LENGTH);
+        decode_rows(words, NULL, output, header.width, header.height,
+                    buffers);
+        FREE(words);
+    } else if (header.gray) {
+        decode_gray(payload, output, header.width, header.height);
+    } else if (staged) {
+        A2Methods_T methods = uarray2_methods_plain;
+        A2Methods_UArray2 word = methods->new(header.width / BLOCKSIZE,
+                                              header.height / BLOCKSIZE,
+                                              sizeof(uint64_t));
+        int width = methods->width(word);
+        int height = methods->height(word);
+        size_t index = 0;
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                uint64_t *cell = methods->at(word, i, j);
+                *cell = IO_get_word(payload, index++, CODE_LENGTH);
+            }
+        }
+        decode_staged(word, methods, output);
+    } else {
+        decode_rows(payload, mapping, output, header.width, header.height,
+                    buffers);
+    }
+}
+
+/*
+ * decompress40_memory
+ *
+ * Decompress an image held in memory, header included, as decompress40_mapped
+ * does for a mapped file. A grayscale image is written as a P5 image, and
+ * the tiles of a tiled image are gathered back into rows first.
+ *
+ * @param const unsigned char *data - Compressed image
+ * @param size_t size               - Number of bytes at data
+ * @param FILE *output              - Stream the image is written to
+ *
+ * @expect                          - An error is raised if data does not
+ *                                    hold a header and all its codewords
+ */
+void decompress40_memory(const unsigned char *data, size_t size,
+                         FILE *output)
+{
+    assert(data != NULL && output != NULL);
+
+    IO_binary_header header;
+    uint64_t *offsets = NULL;
+    int whole = check_compressed(data, size, &header, &offsets);
+    assert(whole);
+
+    decode_memory(data, header, offsets, NULL, output, NULL, 0);
+    if (offsets != NULL) {
+        FREE(offsets);
+    }
+}
+
+/*
+ * decompress40_parallel
+ *
+ * Decompress an image from the given input stream using several threads. The
+ * payload is mapped, or read in one piece when the input cannot be mapped;
+ * each thread then unpacks, unquantizes, and
+ * converts its own band of codeword rows. Every pixel row has a fixed offset
+ * after the P6 header, so when output is a regular file it is preallocated
+ * and each thread writes its rows there with pwrite, with no single writer
+ * at the end. Otherwise the rows fill a buffer laid out as the P6 body that
+ * is written in one piece. The output is identical to decompress40.
+ *
+ * @param FILE *input      - Input stream can be stdin or file input
+ * @param FILE *output     - Stream the PPM image is written to
+ * @param unsigned threads - Number of threads to use
+ *
+ * @expect                 - An error is raised if threads is 0 or a thread
+ *                           cannot be created
+ */
+void decompress40_parallel(FILE *input, FILE *output, unsigned threads)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(threads > 0);
+
+    /* Decode straight from the file when it can be mapped */
+    IO_binary_map map;
+    unsigned char *payload = NULL;
+    unsigned width = 0, height = 0;
+    int mapped = IO_map_binary(input, &map, BLOCKSIZE, CODE_LENGTH);
+    if (mapped) {
+        width = map.width / BLOCKSIZE;
+        height = map.height / BLOCKSIZE;
+    } else {
+        if (read_header(input, output, &width, &height)) {
+            return;
+        }
+        width = width / BLOCKSIZE;
+        height = height / BLOCKSIZE;
+        size_t nbytes = (size_t) width * height * (CODE_LENGTH / CHAR_BIT);
+        payload = IO_read_payload(input, nbytes);
+    }
+
+    size_t stride = (size_t) width * BLOCKSIZE * 3;
+    off_t nbytes = (off_t) stride * height * BLOCKSIZE;
+    struct Band band = {
+        .image = NULL, .word = NULL,
+        .payload = mapped ? map.payload : payload, .pixels = NULL,
+        .stride = stride, .width = width, .methods = methods,
+        .denominator = DENOMINATOR, .output = output, .offset = -1
+    };
+
+    /* Rows go straight to their place in a regular file */
+    if (IO_positional_start(output) >= 0) {
+        IO_write_ppm_header(output, width * BLOCKSIZE, height * BLOCKSIZE,
+                            DENOMINATOR);
+        band.offset = IO_positional_start(output);
+        IO_reserve(output, band.offset + nbytes);
+        run_bands(band, height, threads, decode_band);
+        IO_positional_end(output, band.offset + nbytes);
+    } else {
+        band.pixels = IO_new_output(nbytes);
+        run_bands(band, height, threads, decode_band);
+        IO_send_raw_ppm(output, raw_ppm_header(width * BLOCKSIZE,
+                                               height * BLOCKSIZE),
+                        band.pixels);
+    }
+
+    if (mapped) {
+        IO_unmap_binary(&map);
+    } else {
+        FREE(payload);
+    }
+}
+
+/*
+ * decompress40_pipeline
+ *
+ * Decompress an image from the given input stream with reading, unpacking,
+ * and writing overlapped. A reader thread reads rows of codewords, a
+ * transformer thread unpacks them, and the calling thread writes each pair
+ * of pixel rows. The output is identical to decompress40.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ *
+ * @expect             - An error is raised if a thread cannot be created
+ */
+void decompress40_pipeline(FILE *input, FILE *output)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
+    assert(methods->free != NULL);
+
+    unsigned width = 0, height = 0;
+    if (read_header(input, output, &width, &height)) {
+        return;
+    }
+    width = width / BLOCKSIZE * BLOCKSIZE;
+    height = height / BLOCKSIZE * BLOCKSIZE;
+    IO_write_ppm_header(output, width, height, DENOMINATOR);
+
+    struct Pipeline pipeline = {
+        .input = input, .output = output, .methods = methods,
+        .denominator = DENOMINATOR, .rows = height / BLOCKSIZE,
+        .decompress = 1
+    };
+    run_pipeline(&pipeline, width);
+}
+
+/*
+ * decompress40_staged
+ *
+ * Decompress an image from the given input stream and write it to the output
+ * stream in binary. Every Transform step builds a full-size array; this is
+ * the reference path for decompress40.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ *
+ * @expect             - A2Methods_T function pointers are not null;
+ *                       specifically methods->new, methods->free, 
+ *                       methods->width, and methods->height
+ */
+void decompress40_staged(FILE *input, FILE *output)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    assert(methods != NULL);
+
+    unsigned width = 0, height = 0;
+    if (read_header(input, output, &width, &height)) {
+        return;
+    }
+
+    /* Codeword stored in 2D array is represented by 64 bits integer */
+    A2Methods_UArray2 word = methods->new(width / BLOCKSIZE,
+                                          height / BLOCKSIZE,
+                                          sizeof(uint64_t));
+    IO_read_words(input, word, methods, CODE_LENGTH);
+    decode_staged(word, methods, output);
+}
+
+/*
+ * compress_checked
+ *
+ * Load every sample of the input and check it, then compress it as
+ * compress40_tiled does, or as compress40_staged does when staged is
+ * nonzero. Nothing is written unless the whole input is well formed.
+ *
+ * @param FILE *input   - Input stream can be stdin or file input
+ * @param FILE *output  - Stream the compressed image is written to
+ * @param unsigned tile - Blocks per side of a tile, or 0 for format 2
+ * @param int staged    - Nonzero to run every Transform step
+ * @return int          - 0, or 1 if the input is malformed
+ */
+static int compress_checked(FILE *input, FILE *output, unsigned tile,
+                            int staged)
+{
+    IO_ppm_header header;
+    IO_raw_ppm raw;
+    if (!IO_scan_ppm_header(input, &header)
+        || !IO_load_raw_ppm(input, header, &raw)) {
+        return 1;
+    }
+
+    if (header.channels == 1) {
+        compress_gray(input, output, header, &raw);
+        IO_free_raw_ppm(&raw);
+    } else if (staged) {
+        encode_staged(IO_raw_image(&raw, uarray2_methods_plain), output);
+    } else {
+        encode_raw(&raw, output, tile);
+    }
+
+    return 0;
+}
+
+/*
+ * compress40_checked
+ *
+ * compress40_tiled for callers that cannot catch an exception.
+ *
+ * @param FILE *input   - Input stream can be stdin or file input
+ * @param FILE *output  - Stream the compressed image is written to
+ * @param unsigned tile - Blocks per side of a tile, or 0 for format 2
+ * @return int          - 0, or 1 if the input is malformed
+ */
+int compress40_checked(FILE *input, FILE *output, unsigned tile)
+{
+    assert(input != NULL && output != NULL);
+
+    return compress_checked(input, output, tile, 0);
+}
+
+/*
+ * compress40_staged_checked
+ *
+ * compress40_staged for callers that cannot catch an exception.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ * @return int         - 0, or 1 if the input is malformed
+ */
+int compress40_staged_checked(FILE *input, FILE *output)
+{
+    assert(input != NULL && output != NULL);
+
+    return compress_checked(input, output, 0, 1);
+}
+
+/*
+ * decompress_checked
+ *
+ * Map or read the whole input and check it with check_compressed, then
+ * decompress it with decode_memory. Nothing is written unless the input
+ * holds a header and every codeword it promises.
+ *
+ * @param FILE *input                - Input stream can be stdin or file input
+ * @param FILE *output               - Stream the image is written to
+ * @param Compress40_buffers buffers - Row buffers kept between calls; NULL
+ *                                     to use temporary ones
+ * @param int staged                 - Nonzero to run every Transform step
+ * @return int                       - 0, or 1 if the input is malformed
+ */
+static int decompress_checked(FILE *input, FILE *output,
+                              Compress40_buffers buffers, int staged)
+{
+    IO_mapping mapping;
+    size_t size = 0;
+    const unsigned char *data = IO_load_rest(input, &mapping, &size);
+
+    IO_binary_header header;
+    uint64_t *offsets = NULL;
+    int whole = check_compressed(data, size, &header, &offsets);
+    if (whole) {
+        decode_memory(data, header, offsets, &mapping, output, buffers,
+                      staged);
+    }
+
+    if (offsets != NULL) {
+        FREE(offsets);
+    }
+    IO_unload_rest(&mapping);
+    return !whole;
+}
+
+/*
+ * decompress40_checked
+ *
+ * decompress40_mapped for callers that cannot catch an exception.
+ *
+ * @param FILE *input                - Input stream can be stdin or file input
+ * @param FILE *output               - Stream the image is written to
+ * @param Compress40_buffers buffers - Row buffers kept between calls; NULL
+ *                                     to use temporary ones
+ * @return int                       - 0, or 1 if the input is malformed
+ */
+int decompress40_checked(FILE *input, FILE *output,
+                         Compress40_buffers buffers)
+{
+    assert(input != NULL && output != NULL);
+
+    return decompress_checked(input, output, buffers, 0);
+}
+
+/*
+ * decompress40_staged_checked
+ *
+ * decompress40_staged for callers that cannot catch an exception.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the image is written to
+ * @return int         - 0, or 1 if the input is malformed
+ */
+int decompress40_staged_checked(FILE *input, FILE *output)
+{
+    assert(input != NULL && output != NULL);
+
+    return decompress_checked(input, output, NULL, 1);
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+/*
+ * compress40.h
+ *
+ * Assignment: Arith
+ *
+ * Interface for compressing a PPM image into the COMP40 format and back.
+ * compress40 and decompress40 read from the given stream and write to
+ * stdout. Every other entry point writes to an explicit output stream so
+ * several images can be handled in one process. The staged variants run one
+ * Transform step at a time over full-size arrays and are kept as the
+ * reference the other paths are checked against; all variants produce
+ * identical output.
+ *
+ * A PGM (P2 or P5) input is packed as a grayscale image: a separate header
+ * variant followed by 24-bit codewords holding only the luma coefficients,
+ * and it decompresses back to a P5 image. Every compressor packs a PGM the
+ * same way, two rows at a time, so a PGM needs O(width) memory in any mode.
+ *
+ * compress40_tiled writes an RGB image in the tiled format 3 (see
+ * IO_binary_header) with the tile size it is given; the other compressors
+ * always write format 2. Every decompressor reads both.
+ */
+#ifndef COMPRESS40_INCLUDED
+#define COMPRESS40_INCLUDED
+
+#include <stdio.h>
+
+/*
+ * Row buffers used by the streaming paths. Passing the same buffers to
+ * consecutive calls reuses them as long as the image width does not change.
+ */
+typedef struct Compress40_buffers *Compress40_buffers;
+
+extern Compress40_buffers Compress40_buffers_new(void);
+extern void Compress40_buffers_free(Compress40_buffers *buffers);
+
+/******************************* COMPRESSION **********************************/
+
+/*
+ * compress40
+ *
+ * Compress a PPM image read from input and write the codewords to stdout.
+ * Same as compress40_image(input, stdout).
+ *
+ * @param FILE *input - Input stream can be stdin or file input
+ */
+extern void compress40(FILE *input);
+
+/*
+ * compress40_image
+ *
+ * Read the whole image, then pack each 2 x 2 block into a codeword in a
+ * single pass.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ */
+extern void compress40_image(FILE *input, FILE *output);
+
+/*
+ * compress40_tiled
+ *
+ * compress40_image, writing format 3 with tiles of tile x tile blocks when
+ * tile is nonzero. compress40_image is compress40_tiled(input, output, 0).
+ *
+ * @param FILE *input   - Input stream can be stdin or file input
+ * @param FILE *output  - Stream the compressed image is written to
+ * @param unsigned tile - Blocks per side of a tile, or 0 for format 2
+ */
+extern void compress40_tiled(FILE *input, FILE *output, unsigned tile);
+
+/*
+ * compress40_stream
+ *
+ * Streaming compressor. Reads two pixel rows at a time and writes each row
+ * of codewords before reading the next, so memory does not grow with the
+ * height of the image.
+ *
+ * @param FILE *input                - Input stream can be stdin or file input
+ * @param FILE *output               - Stream the compressed image is written
+ *                                     to
+ * @param Compress40_buffers buffers - Buffers to reuse, or NULL
+ */
+extern void compress40_stream(FILE *input, FILE *output,
+                              Compress40_buffers buffers);
+
+/*
+ * compress40_parallel
+ *
+ * Multithreaded compressor. Horizontal bands of block rows are packed
+ * concurrently, one band per thread.
+ *
+ * @param FILE *input      - Input stream can be stdin or file input
+ * @param FILE *output     - Stream the compressed image is written to
+ * @param unsigned threads - Number of threads, at least 1
+ */
+extern void compress40_parallel(FILE *input, FILE *output, unsigned threads);
+
+/*
+ * compress40_pipeline
+ *
+ * Pipelined compressor. Reading, packing, and writing run on separate
+ * threads connected by lock-free rings of row pairs, so I/O overlaps with
+ * computation.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ */
+extern void compress40_pipeline(FILE *input, FILE *output);
+
+/*
+ * compress40_staged
+ *
+ * Reference compressor built from the staged Transform pipeline.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the compressed image is written to
+ */
+extern void compress40_staged(FILE *input, FILE *output);
+
+/*************************** END COMPRESSION **********************************/
+
+
+/***************************** DECOMPRESSION **********************************/
+
+/*
+ * decompress40
+ *
+ * Decompress a COMP40 image read from input and write it to stdout as a PPM.
+ * Same as decompress40_image(input, stdout).
+ *
+ * @param FILE *input - Input stream can be stdin or file input
+ */
+extern void decompress40(FILE *input);
+
+/*
+ * decompress40_image
+ *
+ * Read every codeword, then unpack each one into its four output pixels in
+ * a single pass.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ */
+extern void decompress40_image(FILE *input, FILE *output);
+
+/*
+ * decompress40_stream
+ *
+ * Streaming decompressor. Decodes one row of codewords into two rows of
+ * pixels and writes them before reading the next row.
+ *
+ * @param FILE *input                - Input stream can be stdin or file input
+ * @param FILE *output               - Stream the PPM image is written to
+ * @param Compress40_buffers buffers - Buffers to reuse, or NULL
+ */
+extern void decompress40_stream(FILE *input, FILE *output,
+                                Compress40_buffers buffers);
+
+/*
+ * decompress40_mapped
+ *
+ * Like decompress40_stream, but a file input is mapped into memory and its
+ * codewords are decoded in place. Falls back to decompress40_stream when
+ * input cannot be mapped. This is what 40image -d runs.
+ *
+ * @param FILE *input                - Input stream can be stdin or file input
+ * @param FILE *output               - Stream the PPM image is written to
+ * @param Compress40_buffers buffers - Buffers to reuse, or NULL
+ */
+extern void decompress40_mapped(FILE *input, FILE *output,
+                                Compress40_buffers buffers);
+
+/*
+ * decompress40_memory
+ *
+ * Decompress an image already in memory, header included, for callers that
+ * hold it in a buffer rather than a file.
+ *
+ * @param const unsigned char *data - Compressed image
+ * @param size_t size               - Number of bytes at data
+ * @param FILE *output              - Stream the image is written to
+ */
+extern void decompress40_memory(const unsigned char *data, size_t size,
+                                FILE *output);
+
+/*
+ * decompress40_parallel
+ *
+ * Multithreaded decompressor. Each thread decodes its own band of codeword
+ * rows into its own slice of the image. A file input is mapped rather than
+ * copied, and when output is a regular file each thread writes its rows
+ * there itself.
+ *
+ * @param FILE *input      - Input stream can be stdin or file input
+ * @param FILE *output     - Stream the PPM image is written to
+ * @param unsigned threads - Number of threads, at least 1
+ */
+extern void decompress40_parallel(FILE *input, FILE *output,
+                                  unsigned threads);
+
+/*
+ * decompress40_pipeline
+ *
+ * Pipelined decompressor. Reading, unpacking, and writing run on separate
+ * threads connected by lock-free rings of rows.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ */
+extern void decompress40_pipeline(FILE *input, FILE *output);
+
+/*
+ * decompress40_staged
+ *
+ * Reference decompressor built from the staged Transform pipeline.
+ *
+ * @param FILE *input  - Input stream can be stdin or file input
+ * @param FILE *output - Stream the PPM image is written to
+ */
+extern void decompress40_staged(FILE *input, FILE *output);
+
+/*************************** END DECOMPRESSION ********************************/
+
+
+/******************************** CHECKED *************************************/
+
+/*
+ * Codecs for callers that cannot catch an exception, such as the worker
+ * threads of a batch: cii keeps one handler stack for the whole process.
+ * Each loads the whole input (mapped when it is a regular file) and checks
+ * it as it parses it, then writes exactly what the codec it names would.
+ * A malformed input makes it return 1 without writing anything, where that
+ * codec would raise.
+ */
+extern int compress40_checked(FILE *input, FILE *output, unsigned tile);
+extern int compress40_staged_checked(FILE *input, FILE *output);
+extern int decompress40_checked(FILE *input, FILE *output,
+                                Compress40_buffers buffers);
+extern int decompress40_staged_checked(FILE *input, FILE *output);
+
+/****************************** END CHECKED ***********************************/
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utest.h"
+#include "except.h"
+#include "assert.h"
+#include "io.h"
+#include "mem.h"
+#include "pnm.h"
+#include "a2plain.h"
+
+/*
+ * Parse the samples of a plain image with IO_read_raw_ppm, from a temporary
+ * file (mapped) when mapped is nonzero and otherwise from memory (read whole).
+ * Returns 1 if they match the nbytes of expected, 0 if they differ, and -1 if
+ * reading raised Pnm_Badformat.
+ */
+static int parse_matches(const char *text, int mapped,
+                         const unsigned char *expected, size_t nbytes)
+{
+    FILE *fp;
+    if (mapped) {
+        fp = tmpfile();
+        fputs(text, fp);
+        rewind(fp);
+    } else {
+        fp = fmemopen((void *) text, strlen(text), "rb");
+    }
+
+    int result = -1;
+    TRY
+        IO_ppm_header header = IO_read_ppm_header(fp);
+        IO_raw_ppm raw = IO_read_raw_ppm(fp, header);
+        result = raw.stride * header.height == nbytes
+                 && memcmp(raw.pixels, expected, nbytes) == 0;
+        IO_free_raw_ppm(&raw);
+    EXCEPT(Pnm_Badformat)
+        result = -1;
+    END_TRY;
+    fclose(fp);
+
+    return result;
+}
+
+UTEST(IO, PlainComments)
+{
+    const char *text = "P3\n2 2\n255\n# first row\n"
+                       "1 2 3 # a comment after samples\n"
+                       "4 5#no space before it\n6\n"
+                       "# a comment longer than the sixteen byte window\n"
+                       "7 8 9 10 11 12\n";
+    const unsigned char expected[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+UTEST(IO, PlainCarriageReturnsAndTabs)
+{
+    const char *text = "P3\n2 2\n255\n"
+                       "10\r\n20\r\n30\r\n\t40\t50\t\t60\r\n"
+                       "70\t\r\n80 \t 90\r\n100\t110\r\n120\r\n";
+    const unsigned char expected[] = {
+        10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120
+    };
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+UTEST(IO, PlainLeadingZeros)
+{
+    /* Up to eight digits take the word at a time path, longer ones do not */
+    const char *text = "P3\n2 2\n255\n"
+                       "0 00 007 0255 00000009 000000017 "
+                       "0000000000000000000042 "
+                       "00000000000000000000000000000000000000000000000001 "
+                       "10 010 0010 00010\n";
+    const unsigned char expected[] = {
+        0, 0, 7, 255, 9, 17, 42, 1, 10, 10, 10, 10
+    };
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+UTEST(IO, PlainLongWhitespaceRuns)
+{
+    char text[512] = "P3\n2 2\n255\n";
+    const unsigned char expected[] = {
+        1, 22, 133, 4, 55, 166, 7, 88, 199, 200, 211, 254
+    };
+    for (size_t k = 0; k < sizeof(expected); k++) {
+        /* Runs longer than the window, and of every length up to it */
+        size_t length = strlen(text);
+        size_t run = k % 2 == 0 ? 37 + k : k;
+        memset(text + length, k % 3 == 0 ? ' ' : '\n', run);
+        sprintf(text + length + run, "%u", expected[k]);
+    }
+    strcat(text, "                                        \n");
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+UTEST(IO, PlainSixteenBitSamples)
+{
+    const char *text = "P3\n2 1\n65535\n"
+                       "65535 256 1\n00065534 4660 43981\n";
+    const unsigned char expected[] = {
+        0xff, 0xff, 0x01, 0x00, 0x00, 0x01,
+        0xff, 0xfe, 0x12, 0x34, 0xab, 0xcd
+    };
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+UTEST(IO, PlainGraySamples)
+{
+    const char *text = "P2\n3 2\n255\n"
+                       "# gray\n  0   128\t255\r\n 64 032 1\n";
+    const unsigned char expected[] = {0, 128, 255, 64, 32, 1};
+    for (int mapped = 0; mapped < 2; mapped++) {
+        EXPECT_EQ(1, parse_matches(text, mapped, expected, sizeof(expected)));
+    }
+}
+
+/*
+ * Whether reading the rows of a plain PPM one at a time with IO_read_ppm_row
+ * raises Pnm_Badformat
+ */
+static int rows_raise(const char *text)
+{
+    FILE *fp = fmemopen((void *) text, strlen(text), "rb");
+    A2Methods_T methods = uarray2_methods_plain;
+    IO_ppm_header header = IO_read_ppm_header(fp);
+    A2Methods_UArray2 row = methods->new(header.width, 1,
+                                         sizeof(struct Pnm_rgb));
+
+    volatile int raised = 0;
+    TRY
+        for (unsigned j = 0; j < header.height; j++) {
+            IO_read_ppm_row(fp, header, row, methods, 0);
+        }
+    EXCEPT(Pnm_Badformat)
+        raised = 1;
+    END_TRY;
+    methods->free(&row);
+    fclose(fp);
+
+    return raised;
+}
+
+/* Whether IO_load_raw_ppm returns 0 for text, mapped as by parse_matches */
+static int load_fails(const char *text, int mapped)
+{
+    FILE *fp;
+    if (mapped) {
+        fp = tmpfile();
+        fputs(text, fp);
+        rewind(fp);
+    } else {
+        fp = fmemopen((void *) text, strlen(text), "rb");
+    }
+
+    IO_ppm_header header;
+    IO_raw_ppm raw;
+    int failed = !IO_scan_ppm_header(fp, &header)
+                 || !IO_load_raw_ppm(fp, header, &raw);
+    if (!failed) {
+        IO_free_raw_ppm(&raw);
+    }
+    fclose(fp);
+
+    return failed;
+}
+
+UTEST(IO, PlainMalformedSamplesRaise)
+{
+    const unsigned char expected[12] = {0};
+    const char *bad[] = {
+        "P3\n2 2\n255\n1 2 3 4 x 6 7 8 9 10 11 12\n",
+        "P3\n2 2\n255\n1 2 3 4 5 6 7 8 9 10 11\n",
+        "P3\n2 2\n255\n1 2 3 4 5 6 7 8 9 10 11 -12\n",
+        "P3\n2 2\n255\n1 2 3 4 5 6 7 8 9 10 11 # 12\n",
+        /* Samples above the denominator, word at a time and not */
+        "P3\n2 2\n255\n300 2 3 4 5 6 7 8 9 10 11 12\n",
+        "P3\n2 2\n255\n1 2 3 4 5 6 7 8 9 10 11 256\n",
+        "P3\n2 2\n1000\n1 2 3 4 5 6 7 8 9 10 11 1001\n",
+        /* Numbers that wrap an unsigned to 0 and to 1 */
+        "P3\n2 2\n255\n1 2 3 4 5 6 7 8 9 10 11 4294967296\n",
+        "P3\n2 2\n255\n4294967297 2 3 4 5 6 7 8 9 10 11 12\n"
+    };
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+        for (int mapped = 0; mapped < 2; mapped++) {
+            EXPECT_EQ(-1, parse_matches(bad[k], mapped, expected,
+                                        sizeof(expected)));
+            EXPECT_EQ(1, load_fails(bad[k], mapped));
+        }
+        EXPECT_EQ(1, rows_raise(bad[k]));
+    }
+}
+
+UTEST(IO, ParseHeaderFormatTwo)
+{
+    const char *text = "COMP40 Compressed image format 2\n7 5\n\x01\x02";
+    IO_binary_header header;
+    ASSERT_EQ(1, IO_parse_header((const unsigned char *) text, strlen(text),
+                                 &header));
+    EXPECT_EQ(7u, header.width);
+    EXPECT_EQ(5u, header.height);
+    EXPECT_EQ(0, header.gray);
+    EXPECT_EQ(0u, header.tile);
+    EXPECT_EQ(strlen(text) - 2, header.offset);
+}
+
+UTEST(IO, ParseHeaderFormatThree)
+{
+    const char *text = "COMP40 Compressed image format 3\n640 480 16\n";
+    IO_binary_header header;
+    ASSERT_EQ(1, IO_parse_header((const unsigned char *) text, strlen(text),
+                                 &header));
+    EXPECT_EQ(640u, header.width);
+    EXPECT_EQ(480u, header.height);
+    EXPECT_EQ(0, header.gray);
+    EXPECT_EQ(16u, header.tile);
+    EXPECT_EQ(strlen(text), header.offset);
+}
+
+UTEST(IO, ParseHeaderGrayscale)
+{
+    const char *text = "COMP40 Compressed grayscale format 2\n4 2\n";
+    IO_binary_header header;
+    ASSERT_EQ(1, IO_parse_header((const unsigned char *) text, strlen(text),
+                                 &header));
+    EXPECT_EQ(4u, header.width);
+    EXPECT_EQ(2u, header.height);
+    EXPECT_EQ(1, header.gray);
+    EXPECT_EQ(0u, header.tile);
+    EXPECT_EQ(strlen(text), header.offset);
+}
+
+UTEST(IO, ParseHeaderRejectsMalformed)
+{
+    const char *bad[] = {
+        "COMP40 Compressed grayscale format 3\n4 2 1\n",
+        "COMP40 Compressed image format 3\n4 2 0\n",
+        "COMP40 Compressed image format 3\n4 2\n",
+        "COMP40 Compressed image format 4\n4 2\n",
+        "COMP40 Compressed image format 2\n4 2",
+        "COMP40 Compressed image"
+    };
+    IO_binary_header header;
+    for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+        EXPECT_EQ(0, IO_parse_header((const unsigned char *) bad[k],
+                                     strlen(bad[k]), &header));
+    }
+}
+
+/* A blocked image of 5 x 3 codewords of 4 bytes, 11 x 6 pixels */
+#define TILED_WIDTH 11
+#define TILED_HEIGHT 6
+#define TILED_WORDS (5 * 3)
+
+/*
+ * Write the codewords of payload as format 3 with tiles of tile x tile
+ * blocks and read the whole file back. Sets its size.
+ */
+static unsigned char *write_tiled(const unsigned char *payload,
+                                  unsigned tile, size_t *size)
+{
+    FILE *fp = tmpfile();
+    IO_write_tiled(fp, TILED_WIDTH, TILED_HEIGHT, payload, 2, 32, tile);
+    *size = ftell(fp);
+    rewind(fp);
+    unsigned char *data = malloc(*size);
+    size_t read = fread(data, 1, *size, fp);
+    fclose(fp);
+
+    return read == *size ? data : NULL;
+}
+
+UTEST(IO, TiledRoundTripWithEdgeTiles)
+{
+    unsigned char payload[TILED_WORDS * 4];
+    for (size_t k = 0; k < sizeof(payload); k++) {
+        payload[k] = 7 * k + 1;
+    }
+
+    for (unsigned tile = 1; tile <= 6; tile++) {
+        size_t size = 0;
+        unsigned char *data = write_tiled(payload, tile, &size);
+        ASSERT_TRUE(data != NULL);
+
+        IO_binary_header header;
+        ASSERT_EQ(1, IO_parse_header(data, size, &header));
+        EXPECT_EQ(tile, header.tile);
+
+        /* Tiles at the right and bottom edges are cut short */
+        size_t count = IO_tile_count(header, 2);
+        size_t across = (5 + tile - 1) / tile, down = (3 + tile - 1) / tile;
+        EXPECT_EQ(across * down, count);
+
+        uint64_t *offsets = IO_parse_index(data + header.offset,
+                                           size - header.offset, header, 2,
+                                           32);
+        EXPECT_EQ((count + 1) * 8, offsets[0]);
+        EXPECT_EQ(size - header.offset, offsets[count]);
+        for (size_t t = 0; t < count; t++) {
+            size_t col = t % across * tile, row = t / across * tile;
+            size_t width = col + tile > 5 ? 5 - col : tile;
+            size_t height = row + tile > 3 ? 3 - row : tile;
+            EXPECT_EQ(width * height * 4, offsets[t + 1] - offsets[t]);
+        }
+
+        unsigned char *untiled = IO_untile(data + header.offset, offsets,
+                                           header, 2, 32);
+        EXPECT_EQ(0, memcmp(untiled, payload, sizeof(payload)));
+
+        FREE(untiled);
+        FREE(offsets);
+        free(data);
+    }
+}
+
+/* Whether IO_parse_index raises on the index of data */
+static int index_raises(const unsigned char *data, size_t size)
+{
+    IO_binary_header header;
+    IO_parse_header(data, size, &header);
+
+    volatile int raised = 0;
+    TRY
+        uint64_t *offsets = IO_parse_index(data + header.offset,
+                                           size - header.offset, header, 2,
+                                           32);
+        FREE(offsets);
+    EXCEPT(Assert_Failed)
+        raised = 1;
+    END_TRY;
+
+    return raised;
+}
+
+/* Whether IO_check_index returns NULL for the index of data */
+static int index_rejected(const unsigned char *data, size_t size)
+{
+    IO_binary_header header;
+    IO_parse_header(data, size, &header);
+
+    uint64_t *offsets = IO_check_index(data + header.offset,
+                                       size - header.offset, header, 2, 32);
+    if (offsets == NULL) {
+        return 1;
+    }
+    FREE(offsets);
+
+    return 0;
+}
+
+UTEST(IO, TiledIndexRejectsBadOffsets)
+{
+    unsigned char payload[TILED_WORDS * 4] = {0};
+    size_t size = 0;
+    unsigned char *data = write_tiled(payload, 2, &size);
+    ASSERT_TRUE(data != NULL);
+    IO_binary_header header;
+    ASSERT_EQ(1, IO_parse_header(data, size, &header));
+    unsigned char *index = data + header.offset;
+
+    EXPECT_EQ(0, index_raises(data, size));
+    EXPECT_EQ(0, index_rejected(data, size));
+
+    /* The low byte of each big-endian offset is its last */
+    index[2 * 8 + 7] += 4;
+    EXPECT_EQ(1, index_raises(data, size));
+    EXPECT_EQ(1, index_rejected(data, size));
+    index[2 * 8 + 7] -= 4;
+
+    index[7] += 8;
+    EXPECT_EQ(1, index_raises(data, size));
+    EXPECT_EQ(1, index_rejected(data, size));
+    index[7] -= 8;
+
+    /* An image cut short of its last tile */
+    EXPECT_EQ(1, index_raises(data, size - 1));
+    EXPECT_EQ(1, index_rejected(data, size - 1));
+
+    free(data);
+}
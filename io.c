@@ -1,20 +1,116 @@
+/* For sync_file_range and vmsplice */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "io.h"
-#include "bitpack.h"
 #include "formulas.h"
 #include "assert.h"
+#include "mem.h"
 
 #define T A2Methods_UArray2
 #define T_Interface A2Methods_T
 
 const unsigned BYTE_WIDTH = 8;
 const char *HEADER = "COMP40 Compressed image format 2\n%u %u";
+const char *GRAY_HEADER = "COMP40 Compressed grayscale format 2\n%u %u";
+const char *TILED_HEADER = "COMP40 Compressed image format 3\n%u %u %u";
 const char DELIMITER = '\n';
+const unsigned MAX_DENOMINATOR = 65535;
+const char *PPM_HEADER = "P%c\n%u %u\n%u\n";
+
+/* Longest header handled in memory: the text plus three 10-digit numbers */
+#define MAX_HEADER 80
+
+/* Bytes of each offset in the index of a tiled image */
+#define OFFSET_BYTES 8
+
+/* Bytes of codewords gathered before each fwrite or read by each fread */
+#define CHUNK 65536
 
 typedef struct Metadata {
     FILE *fp;
     int code_length;
+    unsigned char *buffer;
+    size_t used, filled, remaining;
 } *Metadata;
 
+/* How file I/O treats the page cache; set once with IO_set_cache_mode */
+static IO_cache_mode cache_mode = IO_CACHE_NORMAL;
+
+/* Bytes of a stream left in the page cache behind the current position */
+#define CACHE_WINDOW (8 << 20)
+
+/* Position of fp when streaming past the page cache, otherwise 0 */
+static off_t stream_offset(FILE *fp)
+{
+    return cache_mode == IO_CACHE_STREAM ? ftello(fp) : 0;
+}
+
+/* Tell the kernel fp will be read once from start to end */
+static void advise_sequential(FILE *fp)
+{
+    if (cache_mode == IO_CACHE_STREAM) {
+        (void) posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+}
+
+/*
+ * When streaming past the page cache, drop the pages of fp more than a
+ * window behind its position, each time the position crosses a window
+ * boundary after start. Only the pages that fell behind since start are
+ * touched; earlier ones were dropped by the call that passed them. Pages of
+ * output are written back first: writeback of the latest window is only
+ * started, so just the windows that fell behind are waited on. Failures only
+ * leave pages cached, so they are ignored.
+ */
+static void drop_behind(FILE *fp, off_t start, int dirty)
+{
+    if (cache_mode != IO_CACHE_STREAM) {
+        return;
+    }
+    off_t end = ftello(fp);
+    int fd = fileno(fp);
+    if (end < 0 || fd < 0 || end / CACHE_WINDOW == start / CACHE_WINDOW) {
+        return;
+    }
+
+    off_t behind = (end / CACHE_WINDOW - 1) * (off_t) CACHE_WINDOW;
+    off_t from = (start / CACHE_WINDOW - 1) * (off_t) CACHE_WINDOW;
+    from = from > 0 ? from : 0;
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (dirty) {
+        (void) sync_file_range(fd, behind, end - behind,
+                               SYNC_FILE_RANGE_WRITE);
+    }
+#endif
+    if (behind <= from) {
+        return;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (dirty) {
+        (void) sync_file_range(fd, from, behind - from,
+                               SYNC_FILE_RANGE_WAIT_BEFORE
+                               | SYNC_FILE_RANGE_WRITE
+                               | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+#else
+    if (dirty) {
+        (void) fdatasync(fd);
+    }
+#endif
+    (void) posix_fadvise(fd, from, behind - from, POSIX_FADV_DONTNEED);
+}
+
 static void apply_trim(int i, int j, T image, void *ptr, void *cl)
 {
     (void) image;
@@ -26,16 +122,74 @@ static void apply_trim(int i, int j, T image, void *ptr, void *cl)
     *output_pixel = *(Pnm_rgb) methods->at(input->pixels, i, j);
 }
 
-Pnm_ppm IO_read_plain_image(FILE *fp, T_Interface methods)
+/* Sample of one or two big-endian bytes at p */
+static inline unsigned raw_sample(const unsigned char *p, int bytes)
+{
+    return bytes == 2 ? (unsigned) p[0] << BYTE_WIDTH | p[1] : p[0];
+}
+
+/*
+ * Build a Pnm_rgb array of methods from the samples of a PPM, read with
+ * IO_read_raw_ppm so a plain PPM is parsed by the same code as every other
+ * path. The image is freed with Pnm_ppmfree.
+ */
+static Pnm_ppm read_pixmap(IO_raw_ppm *raw, T_Interface methods)
 {
-    assert(fp != NULL && methods != NULL);
+    IO_ppm_header header = raw->header;
+    int bytes = header.denominator > 255 ? 2 : 1;
 
-    Pnm_ppm image = Pnm_ppmread(fp, methods); 
+    Pnm_ppm image;
+    NEW(image);
+    image->width = header.width;
+    image->height = header.height;
+    image->denominator = header.denominator;
+    image->methods = methods;
+    image->pixels = methods->new(header.width, header.height,
+                                 sizeof(struct Pnm_rgb));
+    for (unsigned j = 0; j < header.height; j++) {
+        const unsigned char *p = raw->pixels + j * raw->stride;
+        for (unsigned i = 0; i < header.width; i++, p += 3 * bytes) {
+            Pnm_rgb pixel = methods->at(image->pixels, i, j);
+            pixel->red = raw_sample(p, bytes);
+            pixel->green = raw_sample(p + bytes, bytes);
+            pixel->blue = raw_sample(p + 2 * bytes, bytes);
+        }
+        IO_consume(&raw->mapping, p);
+    }
+    IO_free_raw_ppm(raw);
+
+    return image;
+}
+
+Pnm_ppm IO_read_plain_image(FILE *fp, IO_ppm_header header,
+                            T_Interface methods)
+{
+    assert(fp != NULL);
+
+    IO_raw_ppm raw = IO_read_raw_ppm(fp, header);
+    return IO_raw_image(&raw, methods);
+}
+
+Pnm_ppm IO_raw_image(IO_raw_ppm *raw, T_Interface methods)
+{
+    assert(raw != NULL && methods != NULL);
+    assert(methods->new != NULL && methods->at != NULL);
+    assert(raw->header.channels == 3);
+
+    Pnm_ppm image = read_pixmap(raw, methods);
     unsigned width = Formulas_get_even(image->width);
     unsigned height = Formulas_get_even(image->height);
     assert(width <= image->width && height <= image->height);
 
-    /* Create a new array and copy pixels over if the dimension is reduced */
+    /* An array that has views is trimmed in place, over its own storage */
+    if ((width < image->width || height < image->height)
+        && methods->view != NULL) {
+        image->pixels = methods->view(image->pixels, 0, 0, width, height);
+        image->width = width;
+        image->height = height;
+    }
+
+    /* Other arrays are copied into a new array of the reduced dimension */
     if (width < image->width || height < image->height) {
         assert(methods->new != NULL);
         assert(methods->map_default != NULL);
@@ -56,17 +210,187 @@ Pnm_ppm IO_read_plain_image(FILE *fp, T_Interface methods)
     return image;
 }
 
+/* Skip whitespace and comments between the fields of a PPM header */
+static void skip_space(FILE *fp)
+{
+    int c = getc(fp);
+    while (c != EOF && (isspace(c) || c == '#')) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = getc(fp);
+            }
+        }
+        c = getc(fp);
+    }
+    ungetc(c, fp);
+}
+
+/*
+ * Digits only, as scan_number takes them: fscanf's %u would also take a sign
+ * and wrap a number too large for an unsigned. Returns 0 if there is none.
+ */
+static int get_number(FILE *fp, unsigned *n)
+{
+    skip_space(fp);
+    int c = getc(fp);
+    if (!isdigit(c)) {
+        return 0;
+    }
+
+    *n = 0;
+    while (isdigit(c)) {
+        unsigned digit = c - '0';
+        if (*n > (UINT_MAX - digit) / 10) {
+            return 0;
+        }
+        *n = *n * 10 + digit;
+        c = getc(fp);
+    }
+    ungetc(c, fp);
+
+    return 1;
+}
+
+static unsigned read_number(FILE *fp)
+{
+    unsigned n = 0;
+    if (!get_number(fp, &n)) {
+        RAISE(Pnm_Badformat);
+    }
+
+    return n;
+}
+
+IO_ppm_header IO_read_ppm_header(FILE *fp)
+{
+    IO_ppm_header header;
+    if (!IO_scan_ppm_header(fp, &header)) {
+        RAISE(Pnm_Badformat);
+    }
+
+    return header;
+}
+
+int IO_scan_ppm_header(FILE *fp, IO_ppm_header *header)
+{
+    assert(fp != NULL && header != NULL);
+
+    advise_sequential(fp);
+    if (getc(fp) != 'P') {
+        return 0;
+    }
+    header->format = getc(fp);
+    if (header->format == '3' || header->format == '6') {
+        header->channels = 3;
+    } else if (header->format == '2' || header->format == '5') {
+        header->channels = 1;
+    } else {
+        return 0;
+    }
+
+    if (!get_number(fp, &header->width) || !get_number(fp, &header->height)
+        || !get_number(fp, &header->denominator)
+        || header->denominator == 0
+        || header->denominator > MAX_DENOMINATOR) {
+        return 0;
+    }
+
+    /* A single whitespace separates the header from raw samples */
+    return !IO_is_raw(*header) || isspace(getc(fp));
+}
+
+static unsigned read_sample(FILE *fp, IO_ppm_header header)
+{
+    if (!IO_is_raw(header)) {
+        unsigned sample = read_number(fp);
+        if (sample > header.denominator) {
+            RAISE(Pnm_Badformat);
+        }
+        return sample;
+    }
+
+    /* Raw samples take two big-endian bytes when the denominator > 255 */
+    int byte = getc(fp);
+    unsigned sample = byte;
+    if (byte != EOF && header.denominator > 255) {
+        byte = getc(fp);
+        sample = (sample << BYTE_WIDTH) | (unsigned) byte;
+    }
+    if (byte == EOF) {
+        RAISE(Pnm_Badformat);
+    }
+
+    return sample;
+}
+
+void IO_read_ppm_row(FILE *fp, IO_ppm_header header, T image,
+                     T_Interface methods, int row)
+{
+    assert(fp != NULL && methods != NULL && methods->at != NULL);
+    assert(methods->width(image) >= (int) header.width);
+    assert(header.channels == 3);
+
+    off_t start = stream_offset(fp);
+    for (unsigned i = 0; i < header.width; i++) {
+        Pnm_rgb pixel = methods->at(image, i, row);
+        pixel->red = read_sample(fp, header);
+        pixel->green = read_sample(fp, header);
+        pixel->blue = read_sample(fp, header);
+    }
+    drop_behind(fp, start, 0);
+}
+
+void IO_read_gray_row(FILE *fp, IO_ppm_header header, unsigned char *samples)
+{
+    assert(fp != NULL && samples != NULL);
+    assert(header.channels == 1);
+
+    off_t start = stream_offset(fp);
+    int bytes = header.denominator > 255 ? 2 : 1;
+    if (IO_is_raw(header)) {
+        size_t nbytes = (size_t) header.width * bytes;
+        if (fread(samples, 1, nbytes, fp) != nbytes) {
+            RAISE(Pnm_Badformat);
+        }
+    } else {
+        for (unsigned i = 0; i < header.width; i++) {
+            unsigned sample = read_sample(fp, header);
+            if (bytes == 2) {
+                *samples++ = sample >> BYTE_WIDTH;
+            }
+            *samples++ = sample;
+        }
+    }
+    drop_behind(fp, start, 0);
+}
+
+/* Write out the codeword bytes gathered so far */
+static void flush_words(Metadata data)
+{
+    off_t start = stream_offset(data->fp);
+    size_t written = fwrite(data->buffer, 1, data->used, data->fp);
+    assert(written == data->used);
+    data->used = 0;
+    drop_behind(data->fp, start, 1);
+}
+
+/* Append one codeword to the buffer in big-endian order */
 static void apply_write_binary(void *ptr, void *cl)
 {
     assert(ptr != NULL && cl != NULL);
     Metadata data = cl;
 
+    if (data->used + data->code_length / BYTE_WIDTH > CHUNK) {
+        flush_words(data);
+    }
+
     int high_byte = data->code_length - BYTE_WIDTH;
-    uint32_t word = *(uint64_t *) ptr;
+    uint64_t word = *(uint64_t *) ptr;
+    unsigned char *p = data->buffer + data->used;
     for (int lsb = high_byte; lsb >= 0; lsb = lsb - BYTE_WIDTH) {
-        uint8_t field = Bitpack_getu(word, BYTE_WIDTH, lsb);
-        putchar((char) field);
+        *p++ = word >> lsb;
     }
+    data->used = p - data->buffer;
 }
 
 void IO_write_binary(FILE *fp, T image, T_Interface methods, int blocksize,
@@ -75,34 +399,89 @@ void IO_write_binary(FILE *fp, T image, T_Interface methods, int blocksize,
     assert(fp != NULL);
     assert(methods != NULL);
     assert(methods->width != NULL && methods->height != NULL);
-    assert(methods->small_map_default != NULL);
 
     int width = methods->width(image) * blocksize;
     int height = methods->height(image) * blocksize;
+    IO_write_header(fp, width, height);
+    IO_write_words(fp, image, methods, code_length);
+}
+
+void IO_write_header(FILE *fp, unsigned width, unsigned height)
+{
+    assert(fp != NULL);
+
     fprintf(fp, HEADER, width, height);
     fprintf(fp, "%c", DELIMITER);
-    
-    struct Metadata data = {.fp = NULL, code_length = code_length};
+}
+
+void IO_write_gray_header(FILE *fp, unsigned width, unsigned height)
+{
+    assert(fp != NULL);
+
+    fprintf(fp, GRAY_HEADER, width, height);
+    fprintf(fp, "%c", DELIMITER);
+}
+
+/*
+ * Codewords are gathered into a chunk on the stack and handed to fwrite a
+ * chunk at a time rather than a byte at a time.
+ */
+void IO_write_words(FILE *fp, T image, T_Interface methods, int code_length)
+{
+    assert(fp != NULL);
+    assert(methods != NULL && methods->small_map_default != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    unsigned char buffer[CHUNK];
+    struct Metadata data = {
+        .fp = fp, .code_length = code_length, .buffer = buffer, .used = 0
+    };
     methods->small_map_default(image, apply_write_binary, &data);
+    flush_words(&data);
+}
+
+/*
+ * Big-endian codeword of the given number of bytes at p. 32-bit codewords are
+ * loaded whole and byte-swapped on little-endian hosts.
+ */
+static inline uint64_t get_big_endian(const unsigned char *p, int bytes)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (bytes == 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        return __builtin_bswap32(word);
+    }
+#endif
+    uint64_t word = 0;
+    for (int k = 0; k < bytes; k++) {
+        word = (word << BYTE_WIDTH) | p[k];
+    }
+
+    return word;
 }
 
+/* Take the next codeword from the buffer, refilling it when it runs out */
 static void apply_read_binary(void *ptr, void *cl)
 {
     assert(ptr != NULL && cl != NULL);
-
     Metadata data = cl;
-    FILE *fp = data->fp;
-    int high_byte = data->code_length - BYTE_WIDTH;
-    uint64_t *word_p = ptr;
 
-    uint64_t word = 0;
-    for (int lsb = high_byte; lsb >= 0; lsb = lsb - BYTE_WIDTH) {
-        int byte = getc(fp);
-        assert(feof(fp) == 0 && byte != EOF);
-        word = Bitpack_newu(word, BYTE_WIDTH, lsb, (uint64_t) byte);
+    int bytes = data->code_length / BYTE_WIDTH;
+    if (data->used == data->filled) {
+        /* Whole codewords only, and never past those the caller asked for */
+        size_t chunk = CHUNK / bytes * bytes;
+        size_t want = data->remaining < chunk ? data->remaining : chunk;
+        off_t start = stream_offset(data->fp);
+        data->filled = fread(data->buffer, 1, want, data->fp);
+        drop_behind(data->fp, start, 0);
+        assert(data->filled == want && want >= (size_t) bytes);
+        data->remaining -= want;
+        data->used = 0;
     }
 
-    *word_p = word;
+    *(uint64_t *) ptr = get_big_endian(data->buffer + data->used, bytes);
+    data->used += bytes;
 }
 
 T IO_read_binary(FILE *fp, T_Interface methods, int blocksize, int code_length)
@@ -110,24 +489,1102 @@ T IO_read_binary(FILE *fp, T_Interface methods, int blocksize, int code_length)
     assert(fp != NULL);
     assert(methods != NULL);
     assert(methods->width != NULL && methods->height != NULL);
-    assert(methods->new != NULL && methods->small_map_default != NULL);
+    assert(methods->new != NULL);
 
-    unsigned width = 0, height = 0;
-    int read = fscanf(fp, HEADER, &width, &height);
+    IO_binary_header header;
+    IO_read_header(fp, &header);
 
-    assert(read == 2);
-    int c = getc(fp);
-    assert(c == DELIMITER);
-
-    width = width / blocksize;
-    height = height / blocksize;
+    unsigned width = header.width / blocksize;
+    unsigned height = header.height / blocksize;
     A2Methods_UArray2 word = methods->new(width, height, sizeof(uint64_t));
+    if (header.tile == 0) {
+        IO_read_words(fp, word, methods, code_length);
+        return word;
+    }
 
-    struct Metadata data = {.fp = fp, .code_length = code_length};
-    methods->small_map_default(word, apply_read_binary, &data);
+    assert(methods->at != NULL);
+    unsigned char *payload = IO_read_tiled(fp, header, blocksize,
+                                           code_length);
+    size_t index = 0;
+    for (unsigned j = 0; j < height; j++) {
+        for (unsigned i = 0; i < width; i++) {
+            uint64_t *cell = methods->at(word, i, j);
+            *cell = IO_get_word(payload, index++, code_length);
+        }
+    }
+    FREE(payload);
 
     return word;
 }
 
+/* Advance *p past the literal text if the bytes before end start with it */
+static int match(const unsigned char **p, const unsigned char *end,
+                 const char *text)
+{
+    size_t n = strlen(text);
+    if ((size_t) (end - *p) < n || memcmp(*p, text, n) != 0) {
+        return 0;
+    }
+    *p += n;
+
+    return 1;
+}
+
+/*
+ * Skip whitespace and parse an unsigned decimal number as %u would, except
+ * that a value too large for unsigned is rejected.
+ */
+static int parse_unsigned(const unsigned char **p, const unsigned char *end,
+                          unsigned *n)
+{
+    const unsigned char *q = *p;
+    while (q < end && isspace(*q)) {
+        q++;
+    }
+    if (q == end || !isdigit(*q)) {
+        return 0;
+    }
+
+    uint64_t value = 0;
+    while (q < end && isdigit(*q)) {
+        value = value * 10 + (*q++ - '0');
+        if (value > UINT_MAX) {
+            return 0;
+        }
+    }
+    *n = value;
+    *p = q;
+
+    return 1;
+}
+
+int IO_parse_header(const unsigned char *text, size_t size,
+                    IO_binary_header *header)
+{
+    assert(text != NULL && header != NULL);
+
+    const unsigned char *p = text;
+    const unsigned char *end = text + size;
+    if (!match(&p, end, "COMP40 Compressed ")) {
+        return 0;
+    }
+
+    int gray = match(&p, end, "grayscale");
+    if (!gray && !match(&p, end, "image")) {
+        return 0;
+    }
+
+    /* Format 3 adds the tile size to the numbers; it has no grayscale form */
+    int tiled = !gray && match(&p, end, " format 3");
+    if (!tiled && !match(&p, end, " format 2")) {
+        return 0;
+    }
+
+    unsigned width = 0, height = 0, tile = 0;
+    if (!parse_unsigned(&p, end, &width) || !parse_unsigned(&p, end, &height)
+        || (tiled && (!parse_unsigned(&p, end, &tile) || tile == 0))
+        || p == end || *p != DELIMITER) {
+        return 0;
+    }
+
+    header->width = width;
+    header->height = height;
+    header->gray = gray;
+    header->tile = tile;
+    header->offset = p + 1 - text;
+
+    return 1;
+}
+
+/*
+ * The header is two lines, so it is read up to the second delimiter and
+ * parsed from memory. Nothing past it is taken from the stream.
+ */
+void IO_read_header(FILE *fp, IO_binary_header *header)
+{
+    assert(fp != NULL && header != NULL);
+
+    advise_sequential(fp);
+    unsigned char text[MAX_HEADER];
+    size_t n = 0;
+    int lines = 0;
+    while (lines < 2 && n < MAX_HEADER) {
+        int c = getc(fp);
+        if (c == EOF) {
+            break;
+        }
+        text[n++] = c;
+        lines += c == DELIMITER;
+    }
+
+    int parsed = IO_parse_header(text, n, header);
+    assert(parsed && header->offset == n);
+}
+
+/*
+ * Exactly the bytes of the codewords in image are read, a chunk at a time, so
+ * the stream is left at the next row.
+ */
+void IO_read_words(FILE *fp, T image, T_Interface methods, int code_length)
+{
+    assert(fp != NULL);
+    assert(methods != NULL && methods->small_map_default != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    unsigned char buffer[CHUNK];
+    size_t bytes = code_length / BYTE_WIDTH;
+    struct Metadata data = {
+        .fp = fp, .code_length = code_length, .buffer = buffer, .used = 0,
+        .filled = 0,
+        .remaining = (size_t) methods->width(image) * methods->height(image)
+                     * bytes
+    };
+    methods->small_map_default(image, apply_read_binary, &data);
+}
+
+unsigned char *IO_read_payload(FILE *fp, size_t nbytes)
+{
+    assert(fp != NULL);
+
+    unsigned char *payload = ALLOC(nbytes > 0 ? nbytes : 1);
+    off_t start = stream_offset(fp);
+    size_t read = fread(payload, 1, nbytes, fp);
+    drop_behind(fp, start, 0);
+    assert(read == nbytes);
+
+    return payload;
+}
+
+uint64_t IO_get_word(const unsigned char *payload, size_t index,
+                     int code_length)
+{
+    assert(payload != NULL);
+
+    int bytes = code_length / BYTE_WIDTH;
+    return get_big_endian(payload + index * bytes, bytes);
+}
+
+void IO_put_word(unsigned char *payload, size_t index, uint64_t word,
+                 int code_length)
+{
+    assert(payload != NULL);
+
+    int bytes = code_length / BYTE_WIDTH;
+    unsigned char *p = payload + index * bytes;
+    for (int k = bytes - 1; k >= 0; k--) {
+        p[k] = word;
+        word >>= BYTE_WIDTH;
+    }
+}
+
+/*
+ * First block column and row of a tile and its width and height in blocks,
+ * which are less than the tile size at the right and bottom edges.
+ */
+typedef struct Tile {
+    size_t col, row, width, height;
+} Tile;
+
+/* Bounds of tile t of an image of columns x rows blocks */
+static Tile tile_bounds(size_t columns, size_t rows, unsigned side, size_t t)
+{
+    size_t across = (columns + side - 1) / side;
+    Tile tile = {.col = t % across * side, .row = t / across * side};
+    tile.width = columns - tile.col < side ? columns - tile.col : side;
+    tile.height = rows - tile.row < side ? rows - tile.row : side;
+
+    return tile;
+}
+
+size_t IO_tile_count(IO_binary_header header, int blocksize)
+{
+    assert(header.tile > 0 && blocksize > 0);
+
+    size_t columns = header.width / blocksize;
+    size_t rows = header.height / blocksize;
+    return (columns + header.tile - 1) / header.tile
+           * ((rows + header.tile - 1) / header.tile);
+}
+
+/*
+ * Every tile of fixed-length codewords has a known length, so the index is
+ * complete before the first tile is written. Each codeword row of a tile is
+ * contiguous in payload and goes out with one fwrite.
+ */
+void IO_write_tiled(FILE *fp, unsigned width, unsigned height,
+                    const unsigned char *payload, int blocksize,
+                    int code_length, unsigned tile)
+{
+    assert(fp != NULL && payload != NULL && tile > 0);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    IO_binary_header header = {
+        .width = width, .height = height, .gray = 0, .tile = tile
+    };
+    size_t count = IO_tile_count(header, blocksize);
+    size_t columns = width / blocksize, rows = height / blocksize;
+    size_t bytes = code_length / BYTE_WIDTH;
+
+    unsigned char *index = ALLOC((count + 1) * OFFSET_BYTES);
+    uint64_t offset = (count + 1) * OFFSET_BYTES;
+    for (size_t t = 0; t < count; t++) {
+        IO_put_word(index, t, offset, OFFSET_BYTES * BYTE_WIDTH);
+        Tile bounds = tile_bounds(columns, rows, tile, t);
+        offset += bounds.width * bounds.height * bytes;
+    }
+    IO_put_word(index, count, offset, OFFSET_BYTES * BYTE_WIDTH);
+
+    fprintf(fp, TILED_HEADER, width, height, tile);
+    fprintf(fp, "%c", DELIMITER);
+    size_t written = fwrite(index, 1, (count + 1) * OFFSET_BYTES, fp);
+    assert(written == (count + 1) * OFFSET_BYTES);
+    FREE(index);
+
+    for (size_t t = 0; t < count; t++) {
+        off_t start = stream_offset(fp);
+        Tile bounds = tile_bounds(columns, rows, tile, t);
+        for (size_t j = 0; j < bounds.height; j++) {
+            const unsigned char *words = payload + ((bounds.row + j) * columns
+                                                    + bounds.col) * bytes;
+            written = fwrite(words, 1, bounds.width * bytes, fp);
+            assert(written == bounds.width * bytes);
+        }
+        drop_behind(fp, start, 1);
+    }
+}
+
+/*
+ * Decode the index at data and check it, returning NULL if it is wrong.
+ * Codewords are fixed-length, so every tile must hold exactly the codewords
+ * of its blocks; a format with variable-length tiles would only need the
+ * offsets to be in order.
+ */
+static uint64_t *parse_offsets(const unsigned char *data,
+                               IO_binary_header header, int blocksize,
+                               int code_length)
+{
+    size_t count = IO_tile_count(header, blocksize);
+    size_t columns = header.width / blocksize;
+    size_t rows = header.height / blocksize;
+    size_t bytes = code_length / BYTE_WIDTH;
+
+    uint64_t *offsets = ALLOC((count + 1) * sizeof(uint64_t));
+    for (size_t t = 0; t <= count; t++) {
+        offsets[t] = IO_get_word(data, t, OFFSET_BYTES * BYTE_WIDTH);
+    }
+    int valid = offsets[0] == (count + 1) * OFFSET_BYTES;
+    for (size_t t = 0; valid && t < count; t++) {
+        Tile bounds = tile_bounds(columns, rows, header.tile, t);
+        valid = offsets[t + 1] >= offsets[t]
+                && offsets[t + 1] - offsets[t]
+                   == bounds.width * bounds.height * bytes;
+    }
+    if (!valid) {
+        FREE(offsets);
+    }
+
+    return offsets;
+}
+
+uint64_t *IO_parse_index(const unsigned char *data, size_t size,
+                         IO_binary_header header, int blocksize,
+                         int code_length)
+{
+    uint64_t *offsets = IO_check_index(data, size, header, blocksize,
+                                       code_length);
+    assert(offsets != NULL);
+
+    return offsets;
+}
+
+uint64_t *IO_check_index(const unsigned char *data, size_t size,
+                         IO_binary_header header, int blocksize,
+                         int code_length)
+{
+    assert(data != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    size_t count = IO_tile_count(header, blocksize);
+    if (size / OFFSET_BYTES <= count) {
+        return NULL;
+    }
+    uint64_t *offsets = parse_offsets(data, header, blocksize, code_length);
+    if (offsets != NULL && offsets[count] > size) {
+        FREE(offsets);
+    }
+
+    return offsets;
+}
+
+/* Read the bytes of the index following a format 3 header */
+static unsigned char *read_index(FILE *fp, size_t count)
+{
+    unsigned char *index = ALLOC((count + 1) * OFFSET_BYTES);
+    size_t read = fread(index, OFFSET_BYTES, count + 1, fp);
+    assert(read == count + 1);
+
+    return index;
+}
+
+uint64_t *IO_read_index(FILE *fp, IO_binary_header header, int blocksize,
+                        int code_length)
+{
+    assert(fp != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    unsigned char *index = read_index(fp, IO_tile_count(header, blocksize));
+    uint64_t *offsets = parse_offsets(index, header, blocksize, code_length);
+    FREE(index);
+    assert(offsets != NULL);
+
+    return offsets;
+}
+
+/* Each codeword row of a tile is copied to its place with one memcpy */
+unsigned char *IO_untile(const unsigned char *data, const uint64_t *offsets,
+                         IO_binary_header header, int blocksize,
+                         int code_length)
+{
+    assert(data != NULL && offsets != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    size_t count = IO_tile_count(header, blocksize);
+    size_t columns = header.width / blocksize;
+    size_t rows = header.height / blocksize;
+    size_t bytes = code_length / BYTE_WIDTH;
+
+    unsigned char *payload = ALLOC(columns * rows * bytes + 1);
+    for (size_t t = 0; t < count; t++) {
+        Tile bounds = tile_bounds(columns, rows, header.tile, t);
+        const unsigned char *words = data + offsets[t];
+        for (size_t j = 0; j < bounds.height; j++) {
+            memcpy(payload + ((bounds.row + j) * columns + bounds.col)
+                             * bytes, words, bounds.width * bytes);
+            words += bounds.width * bytes;
+        }
+    }
+
+    return payload;
+}
+
+/*
+ * The index is read first to learn where the image ends, then the tiles are
+ * read after it into the same buffer, so offsets apply to it unchanged.
+ */
+unsigned char *IO_read_tiled(FILE *fp, IO_binary_header header,
+                             int blocksize, int code_length)
+{
+    assert(fp != NULL);
+    assert(code_length % BYTE_WIDTH == 0 && code_length <= 64);
+
+    size_t count = IO_tile_count(header, blocksize);
+    size_t start = (count + 1) * OFFSET_BYTES;
+    unsigned char *data = read_index(fp, count);
+    uint64_t *offsets = parse_offsets(data, header, blocksize, code_length);
+    assert(offsets != NULL);
+
+    RESIZE(data, offsets[count] + 1);
+    off_t position = stream_offset(fp);
+    size_t read = fread(data + start, 1, offsets[count] - start, fp);
+    drop_behind(fp, position, 0);
+    assert(read == offsets[count] - start);
+
+    unsigned char *payload = IO_untile(data, offsets, header, blocksize,
+                                       code_length);
+    FREE(offsets);
+    FREE(data);
+
+    return payload;
+}
+
+/*
+ * Map fp from its current position to the end of the file. Returns the first
+ * byte at that position and sets the mapping and the bytes left, or returns
+ * NULL if fp is not a regular file with bytes left or cannot be mapped.
+ */
+static const unsigned char *map_rest(FILE *fp, IO_mapping *mapping,
+                                     size_t *available)
+{
+    struct stat info;
+    long offset = ftell(fp);
+    if (offset < 0 || fstat(fileno(fp), &info) != 0 || !S_ISREG(info.st_mode)
+        || info.st_size <= offset) {
+        return NULL;
+    }
+
+    /* mmap offsets are page aligned; the start of the stream need not be */
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t) offset / page * page;
+    size_t length = info.st_size - start;
+    void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), start);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (cache_mode == IO_CACHE_STREAM) {
+        (void) madvise(base, length, MADV_SEQUENTIAL);
+    }
+
+    mapping->base = base;
+    mapping->length = length;
+    mapping->fd = fileno(fp);
+    mapping->offset = start;
+    mapping->released = 0;
+    *available = info.st_size - offset;
+    return (unsigned char *) base + (offset - start);
+}
+
+/* Unmap a mapping made by map_rest, or free a buffer of ours */
+static void release_mapping(IO_mapping *mapping)
+{
+    if (mapping->length > 0) {
+        munmap(mapping->base, mapping->length);
+    } else {
+        FREE(mapping->base);
+    }
+    mapping->base = NULL;
+}
+
+/*
+ * The pages are dropped from the mapping before the page cache, which keeps
+ * a page as long as it is mapped. base is page aligned and the window a
+ * multiple of the page size, so every range is too.
+ */
+void IO_consume(IO_mapping *mapping, const void *position)
+{
+    assert(mapping != NULL);
+    if (cache_mode != IO_CACHE_STREAM || mapping->length == 0) {
+        return;
+    }
+
+    size_t done = (const unsigned char *) position
+                  - (const unsigned char *) mapping->base;
+    if (done < (size_t) 2 * CACHE_WINDOW) {
+        return;
+    }
+    size_t behind = (done / CACHE_WINDOW - 1) * (size_t) CACHE_WINDOW;
+    if (behind <= mapping->released) {
+        return;
+    }
+
+    size_t nbytes = behind - mapping->released;
+    (void) madvise((char *) mapping->base + mapping->released, nbytes,
+                   MADV_DONTNEED);
+    (void) posix_fadvise(mapping->fd, mapping->offset + mapping->released,
+                         nbytes, POSIX_FADV_DONTNEED);
+    mapping->released = behind;
+}
+
+/*
+ * Plain samples are parsed from memory sixteen bytes at a time: one compare
+ * per class gives a bit per byte for digits and for whitespace, so a run of
+ * separators is skipped and a number's length found with a count of trailing
+ * zeros instead of a branch per character.
+ */
+#define WINDOW 16
+
+/* Bit k is set if p[k] is a decimal digit, for k < WINDOW */
+static inline unsigned digit_mask(const unsigned char *p)
+{
+#ifdef __SSE2__
+    /* Bytes above 127 compare as negative, so they are not digits either */
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i low = _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1));
+    __m128i high = _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1));
+    return _mm_movemask_epi8(_mm_and_si128(low, high));
+#else
+    unsigned mask = 0;
+    for (int k = 0; k < WINDOW; k++) {
+        mask |= (unsigned) (p[k] >= '0' && p[k] <= '9') << k;
+    }
+    return mask;
+#endif
+}
+
+/* Bit k is set if p[k] is whitespace as isspace sees it in the C locale */
+static inline unsigned space_mask(const unsigned char *p)
+{
+#ifdef __SSE2__
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i blank = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i after_tab = _mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1));
+    __m128i before_cr = _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1));
+    __m128i control = _mm_and_si128(after_tab, before_cr);
+    return _mm_movemask_epi8(_mm_or_si128(blank, control));
+#else
+    unsigned mask = 0;
+    for (int k = 0; k < WINDOW; k++) {
+        mask |= (unsigned) (p[k] == ' ' || (p[k] >= '\t' && p[k] <= '\r'))
+                << k;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Value of the len <= 8 digits at p, with 8 bytes readable at p. The digits
+ * are loaded as one word and combined pairwise: tens, then hundreds, then
+ * ten-thousands, so 8 digits take three multiplies.
+ */
+static inline unsigned parse_digits(const unsigned char *p, unsigned len)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+
+    /* Only bytes past the digits can borrow, and they are shifted out */
+    chunk = (chunk - UINT64_C(0x3030303030303030)) << (8 * (8 - len));
+    chunk = (chunk * 10 + (chunk >> 8)) & UINT64_C(0x00FF00FF00FF00FF);
+    chunk = (chunk * 100 + (chunk >> 16)) & UINT64_C(0x0000FFFF0000FFFF);
+    chunk = (chunk * 10000 + (chunk >> 32)) & UINT64_C(0x00000000FFFFFFFF);
+    return chunk;
+#else
+    unsigned n = 0;
+    for (unsigned k = 0; k < len; k++) {
+        n = n * 10 + (p[k] - '0');
+    }
+    return n;
+#endif
+}
+
+/*
+ * Skip whitespace and comments from *p and parse the number that follows a
+ * character at a time, as read_number does. Returns 0 if there is none or
+ * it does not fit in an unsigned.
+ */
+static int scan_number(const unsigned char **p, const unsigned char *end,
+                       unsigned *n)
+{
+    const unsigned char *q = *p;
+    while (q < end && (isspace(*q) || *q == '#')) {
+        if (*q == '#') {
+            while (q < end && *q != '\n') {
+                q++;
+            }
+        } else {
+            q++;
+        }
+    }
+    if (q == end || !isdigit(*q)) {
+        return 0;
+    }
+
+    *n = 0;
+    while (q < end && isdigit(*q)) {
+        unsigned digit = *q++ - '0';
+        if (*n > (UINT_MAX - digit) / 10) {
+            return 0;
+        }
+        *n = *n * 10 + digit;
+    }
+    *p = q;
+
+    return 1;
+}
+
+/*
+ * Parse count plain samples from the text at p into out, each as one byte or
+ * two big-endian bytes. Returns the position after the last, or NULL if the
+ * text ends early, holds anything other than digits, whitespace and
+ * comments, or has a sample above denominator.
+ */
+static const unsigned char *parse_plain(const unsigned char *p,
+                                        const unsigned char *end,
+                                        unsigned char *out, size_t count,
+                                        int bytes, unsigned denominator)
+{
+    for (size_t k = 0; k < count; k++) {
+        unsigned sample = 0;
+        unsigned len = 0;
+        while (end - p >= WINDOW) {
+            unsigned digits = digit_mask(p);
+            if (digits & 1) {
+                /* The bit past the window ends a run of WINDOW digits */
+                len = __builtin_ctz(~digits);
+                break;
+            }
+            unsigned skip = __builtin_ctz(~space_mask(p));
+            if (skip == 0) {
+                break;
+            }
+            p += skip;
+        }
+
+        if (len > 0 && len <= 8) {
+            sample = parse_digits(p, len);
+            p += len;
+        } else if (!scan_number(&p, end, &sample)) {
+            return NULL;
+        }
+        if (sample > denominator) {
+            return NULL;
+        }
+
+        if (bytes == 2) {
+            *out++ = sample >> BYTE_WIDTH;
+        }
+        *out++ = sample;
+    }
+
+    return p;
+}
+
+/*
+ * Read fp to the end into a new buffer, for streams that cannot be mapped.
+ * Sets the number of bytes read.
+ */
+static unsigned char *read_rest(FILE *fp, size_t *size)
+{
+    size_t capacity = CHUNK;
+    unsigned char *text = ALLOC(capacity);
+    *size = 0;
+    for (;;) {
+        *size += fread(text + *size, 1, capacity - *size, fp);
+        if (*size < capacity) {
+            break;
+        }
+        capacity *= 2;
+        RESIZE(text, capacity);
+    }
+
+    return text;
+}
+
+IO_raw_ppm IO_read_raw_ppm(FILE *fp, IO_ppm_header header)
+{
+    IO_raw_ppm raw;
+    if (!IO_load_raw_ppm(fp, header, &raw)) {
+        RAISE(Pnm_Badformat);
+    }
+
+    return raw;
+}
+
+int IO_load_raw_ppm(FILE *fp, IO_ppm_header header, IO_raw_ppm *raw)
+{
+    assert(fp != NULL && raw != NULL);
+
+    raw->header = header;
+    raw->pixels = NULL;
+    size_t bytes = header.denominator > 255 ? 2 : 1;
+    raw->stride = (size_t) header.width * header.channels * bytes;
+    if (header.height > 0 && raw->stride > SIZE_MAX / header.height) {
+        return 0;
+    }
+    size_t nbytes = raw->stride * header.height;
+
+    size_t available = 0;
+    if (IO_is_raw(header)) {
+        raw->pixels = map_rest(fp, &raw->mapping, &available);
+    }
+    if (raw->pixels != NULL) {
+        if (available < nbytes) {
+            release_mapping(&raw->mapping);
+            return 0;
+        }
+        return 1;
+    }
+
+    unsigned char *pixels = ALLOC(nbytes > 0 ? nbytes : 1);
+    if (IO_is_raw(header)) {
+        /* Not mappable, e.g. a pipe: read every sample in one call */
+        if (fread(pixels, 1, nbytes, fp) != nbytes) {
+            FREE(pixels);
+            return 0;
+        }
+    } else {
+        /*
+         * Plain samples are parsed from the mapped text, or a copy of it, a
+         * row at a time so text already parsed can be dropped
+         */
+        IO_mapping text = {.base = NULL, .length = 0};
+        size_t size = 0;
+        const unsigned char *p = map_rest(fp, &text, &size);
+        if (p == NULL) {
+            p = read_rest(fp, &size);
+            text.base = (void *) p;
+        }
+        const unsigned char *end = p + size;
+        for (unsigned j = 0; j < header.height && p != NULL; j++) {
+            p = parse_plain(p, end, pixels + j * raw->stride,
+                            raw->stride / bytes, bytes, header.denominator);
+            if (p != NULL) {
+                IO_consume(&text, p);
+            }
+        }
+        release_mapping(&text);
+        if (p == NULL) {
+            FREE(pixels);
+            return 0;
+        }
+    }
+    raw->pixels = pixels;
+    raw->mapping.base = pixels;
+    raw->mapping.length = 0;
+
+    return 1;
+}
+
+/* A stream that cannot be mapped, e.g. a pipe or a memory stream, is read */
+const unsigned char *IO_load_rest(FILE *fp, IO_mapping *mapping, size_t *size)
+{
+    assert(fp != NULL && mapping != NULL && size != NULL);
+
+    const unsigned char *data = map_rest(fp, mapping, size);
+    if (data == NULL) {
+        data = read_rest(fp, size);
+        mapping->base = (void *) data;
+        mapping->length = 0;
+    }
+
+    return data;
+}
+
+void IO_unload_rest(IO_mapping *mapping)
+{
+    assert(mapping != NULL && mapping->base != NULL);
+
+    release_mapping(mapping);
+}
+
+void IO_free_raw_ppm(IO_raw_ppm *raw)
+{
+    assert(raw != NULL && raw->mapping.base != NULL);
+
+    release_mapping(&raw->mapping);
+    raw->pixels = NULL;
+}
+
+int IO_map_binary(FILE *fp, IO_binary_map *map, int blocksize,
+                  int codelength)
+{
+    assert(fp != NULL && map != NULL);
+
+    IO_mapping mapping;
+    size_t available = 0;
+    const unsigned char *header = map_rest(fp, &mapping, &available);
+    if (header == NULL) {
+        return 0;
+    }
+
+    /* The header is parsed in place; the mapping needs no terminator */
+    IO_binary_header parsed;
+    int read = IO_parse_header(header, available, &parsed);
+    assert(read);
+    if (parsed.gray || parsed.tile > 0) {
+        /* Grayscale and tiled codewords are left to the stream path */
+        release_mapping(&mapping);
+        return 0;
+    }
+
+    size_t bytes = (size_t) (parsed.width / blocksize)
+                   * (parsed.height / blocksize) * (codelength / BYTE_WIDTH);
+    assert(available - parsed.offset >= bytes);
+
+    map->width = parsed.width;
+    map->height = parsed.height;
+    map->payload = header + parsed.offset;
+    map->mapping = mapping;
+
+    return 1;
+}
+
+void IO_unmap_binary(IO_binary_map *map)
+{
+    assert(map != NULL && map->mapping.base != NULL);
+
+    release_mapping(&map->mapping);
+    map->payload = NULL;
+}
+
+/* Write every buffer of iov, resuming after short writes */
+static void write_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        assert(written >= 0);
+
+        size_t done = written;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+void IO_write_raw_ppm(FILE *fp, IO_ppm_header header,
+                      const unsigned char *pixels)
+{
+    assert(fp != NULL && pixels != NULL);
+    assert(header.format == '5' || header.format == '6');
+    assert(header.denominator > 0 && header.denominator <= MAX_DENOMINATOR);
+
+    char text[MAX_HEADER];
+    int length = snprintf(text, sizeof(text), PPM_HEADER, header.format,
+                          header.width, header.height, header.denominator);
+    size_t bytes = header.denominator > 255 ? 2 : 1;
+    size_t nbytes = (size_t) header.width * header.height * header.channels
+                    * bytes;
+
+    /* A stream without a descriptor (e.g. fmemopen) still goes through stdio */
+    int fd = fileno(fp);
+    if (fd < 0) {
+        fputs(text, fp);
+        size_t written = fwrite(pixels, 1, nbytes, fp);
+        assert(written == nbytes);
+        return;
+    }
+
+    int flushed = fflush(fp);
+    assert(flushed == 0);
+    struct iovec iov[] = {
+        {.iov_base = text, .iov_len = length},
+        {.iov_base = (void *) pixels, .iov_len = nbytes}
+    };
+    write_all(fd, iov, 2);
+}
+
+int IO_is_pipe(FILE *fp)
+{
+    assert(fp != NULL);
+
+    struct stat info;
+    int fd = fileno(fp);
+    return fd >= 0 && fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/* Bytes mapped for an output buffer of nbytes; mmap refuses 0 */
+static size_t output_length(size_t nbytes)
+{
+    return nbytes > 0 ? nbytes : 1;
+}
+
+unsigned char *IO_new_output(size_t nbytes)
+{
+    unsigned char *base = mmap(NULL, output_length(nbytes),
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(base != MAP_FAILED);
+
+    return base;
+}
+
+static void free_output(unsigned char *body, size_t nbytes)
+{
+    munmap(body, output_length(nbytes));
+}
+
+/*
+ * Splice iov into the pipe fd, advancing it past what the pipe took, until
+ * it is empty or the pipe refuses. Whole pages at a page boundary are gifted
+ * (SPLICE_F_GIFT), so the pipe may keep them rather than copy them later;
+ * the kernel only accepts a gift whose start and length are page aligned, so
+ * a last partial page goes without.
+ */
+static void splice_all(int fd, struct iovec *iov)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    while (iov->iov_len > 0) {
+        struct iovec part = *iov;
+        unsigned flags = 0;
+        if ((uintptr_t) part.iov_base % page == 0 && part.iov_len >= page) {
+            part.iov_len = part.iov_len / page * page;
+            flags = SPLICE_F_GIFT;
+        }
+        ssize_t spliced = vmsplice(fd, &part, 1, flags);
+        if (spliced < 0 && errno == EINTR) {
+            continue;
+        }
+        if (spliced <= 0) {
+            break;
+        }
+        iov->iov_base = (char *) iov->iov_base + spliced;
+        iov->iov_len -= spliced;
+    }
+}
+
+/*
+ * Write the header text followed by the nbytes of body, a buffer from
+ * IO_new_output, and unmap the buffer. Into a pipe the header is written on
+ * its own and the body, which starts on a page boundary, is spliced, so the
+ * pipe takes references to its pages instead of a copy; since the buffer is
+ * never written again, unmapping it straight after is safe. If the pipe
+ * refuses, or fp is not a pipe, the rest is written.
+ */
+static void send_output(FILE *fp, const char *text, size_t length,
+                        unsigned char *body, size_t nbytes)
+{
+    int flushed = fflush(fp);
+    assert(flushed == 0);
+    int fd = fileno(fp);
+    struct iovec iov[2] = {
+        {.iov_base = (void *) text, .iov_len = length},
+        {.iov_base = body, .iov_len = nbytes}
+    };
+    if (IO_is_pipe(fp)) {
+        write_all(fd, iov, 1);
+        splice_all(fd, &iov[1]);
+        write_all(fd, &iov[1], 1);
+    } else {
+        write_all(fd, iov, 2);
+    }
+
+    free_output(body, nbytes);
+}
+
+void IO_send_raw_ppm(FILE *fp, IO_ppm_header header, unsigned char *pixels)
+{
+    assert(fp != NULL && pixels != NULL);
+    assert(header.format == '5' || header.format == '6');
+    assert(header.denominator > 0 && header.denominator <= MAX_DENOMINATOR);
+
+    char text[MAX_HEADER];
+    int length = snprintf(text, sizeof(text), PPM_HEADER, header.format,
+                          header.width, header.height, header.denominator);
+    size_t bytes = header.denominator > 255 ? 2 : 1;
+    size_t nbytes = (size_t) header.width * header.height * header.channels
+                    * bytes;
+
+    /* A stream without a descriptor (e.g. fmemopen) still goes through stdio */
+    if (fileno(fp) < 0) {
+        IO_write_raw_ppm(fp, header, pixels);
+        free_output(pixels, nbytes);
+        return;
+    }
+    send_output(fp, text, length, pixels, nbytes);
+}
+
+void IO_send_binary(FILE *fp, unsigned width, unsigned height,
+                    unsigned char *payload, int blocksize, int code_length,
+                    unsigned tile)
+{
+    assert(fp != NULL && payload != NULL);
+
+    char text[MAX_HEADER];
+    int length = snprintf(text, sizeof(text), HEADER, width, height);
+    text[length++] = DELIMITER;
+    size_t nbytes = (size_t) (width / blocksize) * (height / blocksize)
+                    * (code_length / BYTE_WIDTH);
+
+    if (tile > 0) {
+        IO_write_tiled(fp, width, height, payload, blocksize, code_length,
+                       tile);
+    } else if (fileno(fp) < 0) {
+        size_t written = fwrite(text, 1, length, fp);
+        written += fwrite(payload, 1, nbytes, fp);
+        assert(written == length + nbytes);
+    } else {
+        send_output(fp, text, length, payload, nbytes);
+        return;
+    }
+    free_output(payload, nbytes);
+}
+
+off_t IO_positional_start(FILE *fp)
+{
+    assert(fp != NULL);
+
+    struct stat info;
+    int fd = fileno(fp);
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+        || (fcntl(fd, F_GETFL) & O_APPEND) != 0) {
+        return -1;
+    }
+
+    int flushed = fflush(fp);
+    assert(flushed == 0);
+    return ftello(fp);
+}
+
+void IO_reserve(FILE *fp, off_t end)
+{
+    assert(fp != NULL);
+
+    /* Only an optimization: a later pwrite reports any real failure */
+    off_t start = ftello(fp);
+    if (start >= 0 && end > start) {
+        (void) posix_fallocate(fileno(fp), start, end - start);
+    }
+}
+
+void IO_write_at(FILE *fp, const void *bytes, size_t nbytes, off_t offset)
+{
+    assert(fp != NULL && bytes != NULL);
+
+    int fd = fileno(fp);
+    const char *p = bytes;
+    while (nbytes > 0) {
+        ssize_t written = pwrite(fd, p, nbytes, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        assert(written > 0);
+        p += written;
+        nbytes -= written;
+        offset += written;
+    }
+}
+
+void IO_positional_end(FILE *fp, off_t end)
+{
+    assert(fp != NULL);
+
+    int moved = fseeko(fp, end, SEEK_SET);
+    assert(moved == 0);
+}
+
+void IO_write_ppm_header(FILE *fp, unsigned width, unsigned height,
+                         unsigned denominator)
+{
+    assert(fp != NULL);
+    assert(denominator > 0 && denominator <= MAX_DENOMINATOR);
+
+    fprintf(fp, PPM_HEADER, '6', width, height, denominator);
+}
+
+/* Rows decoded straight into raw samples go out with one fwrite */
+void IO_write_ppm_rows(FILE *fp, const unsigned char *rows, size_t nbytes)
+{
+    assert(fp != NULL && rows != NULL);
+
+    off_t start = stream_offset(fp);
+    size_t written = fwrite(rows, 1, nbytes, fp);
+    assert(written == nbytes);
+    drop_behind(fp, start, 1);
+}
+
+void IO_set_cache_mode(IO_cache_mode mode)
+{
+    cache_mode = mode;
+}
+
+void IO_release_cache(FILE *fp)
+{
+    assert(fp != NULL);
+
+    if (cache_mode == IO_CACHE_STREAM && fflush(fp) == 0) {
+        IO_release_fd(fileno(fp));
+    }
+}
+
+void IO_release_fd(int fd)
+{
+    if (cache_mode != IO_CACHE_STREAM || fd < 0) {
+        return;
+    }
+
+    /* Dirty pages cannot be dropped until they are written back */
+    (void) fdatasync(fd);
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
 #undef T
 #undef T_Interface
\ No newline at end of file
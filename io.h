@@ -2,20 +2,287 @@
 #define IO_INCLUDED
 
 #include <stdlib.h>
-#include "pnm.h"
+#include <stdint.h>
+#include <sys/types.h>
 #include "a2methods.h"
+#include "pnm.h"
 
 #define T A2Methods_UArray2
 #define T_Interface A2Methods_T
 
-extern Pnm_ppm IO_read_plain_image(FILE *fp, T_Interface methods);
+/*
+ * Dimensions and format of a PPM or PGM read by IO_read_ppm_header. format
+ * is '3' (PPM) or '2' (PGM) for plain (ASCII) samples and '6' (PPM) or '5'
+ * (PGM) for raw (binary) samples. channels is 3 for PPM and 1 for PGM.
+ */
+typedef struct IO_ppm_header {
+    unsigned width, height, denominator, channels;
+    char format;
+} IO_ppm_header;
+
+static inline int IO_is_raw(IO_ppm_header header)
+{
+    return header.format == '5' || header.format == '6';
+}
+
+/*
+ * Streaming input: the header first, then one row of pixels at a time.
+ * IO_read_ppm_row reads a PPM row into Pnm_rgb element row of image, and
+ * IO_read_gray_row reads a PGM row into samples laid out as in a P5 file
+ * (header.width samples of one or two big-endian bytes).
+ */
+extern IO_ppm_header IO_read_ppm_header(FILE *fp);
+extern void IO_read_ppm_row(FILE *fp, IO_ppm_header header, T image,
+                            T_Interface methods, int row);
+extern void IO_read_gray_row(FILE *fp, IO_ppm_header header,
+                             unsigned char *samples);
+
+/*
+ * The rest of a PPM whose header has been read, as a Pnm_rgb array of
+ * methods trimmed to even dimensions. Freed with Pnm_ppmfree.
+ */
+extern Pnm_ppm IO_read_plain_image(FILE *fp, IO_ppm_header header,
+                                   T_Interface methods);
 
 extern void IO_write_binary(FILE *fp, T image, T_Interface methods,
                             int blocksize, int codelength);
 
+/* The two halves of IO_write_binary, for writers that emit rows as they go */
+extern void IO_write_header(FILE *fp, unsigned width, unsigned height);
+
+/* Header of a grayscale image, whose codewords are luma only */
+extern void IO_write_gray_header(FILE *fp, unsigned width, unsigned height);
+extern void IO_write_words(FILE *fp, T image, T_Interface methods,
+                           int codelength);
+
 extern T IO_read_binary(FILE *fp, T_Interface methods, int blocksize, 
                         int codelength);
 
+/*
+ * Header of a compressed image. offset is the number of header bytes,
+ * delimiter included, so what follows starts at text + offset. tile is 0 for
+ * format 2, whose codewords follow in row-major order. Format 3 (RGB only)
+ * cuts the blocks into tiles of tile x tile blocks, smaller at the right and
+ * bottom edges, stored in row-major order of tiles with the codewords of
+ * each tile in row-major order. The tiles are preceded by an index of
+ * IO_tile_count + 1 big-endian 64-bit offsets counted from the end of the
+ * header: tile t spans offsets t to t + 1, and the last offset is the end of
+ * the image, so any tile can be found without reading those before it even
+ * once tiles differ in length.
+ */
+typedef struct IO_binary_header {
+    unsigned width, height;
+    int gray;
+    unsigned tile;
+    size_t offset;
+} IO_binary_header;
+
+/*
+ * The two halves of IO_read_binary, for readers that decode row by row.
+ * IO_read_header accepts any header; IO_read_words only reads the codewords
+ * of format 2.
+ */
+extern void IO_read_header(FILE *fp, IO_binary_header *header);
+extern void IO_read_words(FILE *fp, T image, T_Interface methods,
+                          int codelength);
+
+/*
+ * Parse any header from the first size bytes of text, which need not be
+ * NUL-terminated. Returns 0 if they do not begin with a complete header.
+ * IO_read_header and IO_map_binary are both built on it.
+ */
+extern int IO_parse_header(const unsigned char *text, size_t size,
+                           IO_binary_header *header);
+
+/*
+ * Tiled images (format 3). IO_write_tiled writes a format 3 header, index,
+ * and tiles of tile x tile blocks for the row-major codewords in payload;
+ * IO_send_binary does the same when given a nonzero tile. IO_write_binary
+ * always writes format 2.
+ *
+ * IO_parse_index checks the index at data, the first byte after a format 3
+ * header, and returns its offsets, to be freed with FREE; the size bytes at
+ * data must hold every tile, and tile t then starts at data + offsets[t].
+ * IO_read_index does the same from a stream positioned after the header,
+ * leaving it at the first tile. IO_untile gathers the tiles back into
+ * row-major codewords, and IO_read_tiled reads the index and tiles from a
+ * stream and does the same. An error is raised if an offset is out of order
+ * or a tile does not hold exactly the codewords of its blocks.
+ */
+extern size_t IO_tile_count(IO_binary_header header, int blocksize);
+extern void IO_write_tiled(FILE *fp, unsigned width, unsigned height,
+                           const unsigned char *payload, int blocksize,
+                           int codelength, unsigned tile);
+extern uint64_t *IO_parse_index(const unsigned char *data, size_t size,
+                                IO_binary_header header, int blocksize,
+                                int codelength);
+extern uint64_t *IO_read_index(FILE *fp, IO_binary_header header,
+                               int blocksize, int codelength);
+extern unsigned char *IO_untile(const unsigned char *data,
+                                const uint64_t *offsets,
+                                IO_binary_header header, int blocksize,
+                                int codelength);
+extern unsigned char *IO_read_tiled(FILE *fp, IO_binary_header header,
+                                    int blocksize, int codelength);
+
+/*
+ * Raw codeword bytes. IO_read_payload reads nbytes following the header;
+ * IO_get_word extracts the big-endian codeword at index, so any block row
+ * can be found from the width alone.
+ */
+extern unsigned char *IO_read_payload(FILE *fp, size_t nbytes);
+extern uint64_t IO_get_word(const unsigned char *payload, size_t index,
+                            int codelength);
+
+/*
+ * A read-only mapping of a file from the page-aligned offset to its end, or
+ * with length 0 a buffer of ours. When streaming past the page cache,
+ * IO_consume tells it the bytes before position are done with: pages more
+ * than a window behind are dropped from the mapping and from the page cache,
+ * as drop_behind does for stdio streams, so a large mapped input does not
+ * stay cached. It is a no-op for a buffer or in IO_CACHE_NORMAL.
+ */
+typedef struct IO_mapping {
+    void *base;
+    size_t length;
+    int fd;
+    off_t offset;
+    size_t released;    /* bytes from base already dropped */
+} IO_mapping;
+
+extern void IO_consume(IO_mapping *mapping, const void *position);
+
+/*
+ * The samples of a P6 or P5 image exactly as they are in the file: mapped
+ * when fp is a regular file, otherwise read in one piece. Plain (P3 or P2)
+ * samples are parsed from the mapped (or read) text sixteen bytes at a time
+ * and converted to the same layout. Row j starts at
+ * pixels + j * stride. IO_read_raw_ppm is called after IO_read_ppm_header
+ * and raises Pnm_Badformat if the file is shorter than the header promises.
+ */
+typedef struct IO_raw_ppm {
+    IO_ppm_header header;
+    const unsigned char *pixels;
+    size_t stride;
+    IO_mapping mapping;
+} IO_raw_ppm;
+
+extern IO_raw_ppm IO_read_raw_ppm(FILE *fp, IO_ppm_header header);
+extern void IO_free_raw_ppm(IO_raw_ppm *raw);
+
+/*
+ * The samples of a PPM read with IO_read_raw_ppm as a Pnm_rgb array of
+ * methods, trimmed as by IO_read_plain_image. raw is freed.
+ */
+extern Pnm_ppm IO_raw_image(IO_raw_ppm *raw, T_Interface methods);
+
+/*
+ * Checked input, for callers that cannot catch an exception, e.g. the
+ * workers of a batch. IO_scan_ppm_header, IO_load_raw_ppm and
+ * IO_check_index do what IO_read_ppm_header, IO_read_raw_ppm and
+ * IO_parse_index do, but return 0 (or NULL) where those raise. IO_load_rest
+ * maps fp from its position to the end of the file, or reads the rest of a
+ * stream that cannot be mapped, and sets the mapping, to be released with
+ * IO_unload_rest, and the number of bytes.
+ */
+extern int IO_scan_ppm_header(FILE *fp, IO_ppm_header *header);
+extern int IO_load_raw_ppm(FILE *fp, IO_ppm_header header, IO_raw_ppm *raw);
+extern uint64_t *IO_check_index(const unsigned char *data, size_t size,
+                                IO_binary_header header, int blocksize,
+                                int codelength);
+extern const unsigned char *IO_load_rest(FILE *fp, IO_mapping *mapping,
+                                         size_t *size);
+extern void IO_unload_rest(IO_mapping *mapping);
+
+/*
+ * A compressed image mapped read-only into memory, from the current position
+ * of the stream to the end of the file. payload points at the first
+ * codeword and width and height are as written in the header.
+ */
+typedef struct IO_binary_map {
+    unsigned width, height;
+    const unsigned char *payload;
+    IO_mapping mapping;
+} IO_binary_map;
+
+/*
+ * IO_map_binary returns 0 and leaves map untouched when fp is not a regular
+ * file (e.g. a pipe), cannot be mapped, or holds a grayscale or tiled image,
+ * so the caller can fall back to reading the stream.
+ */
+extern int IO_map_binary(FILE *fp, IO_binary_map *map, int blocksize,
+                         int codelength);
+extern void IO_unmap_binary(IO_binary_map *map);
+
+/*
+ * Whole-image output: a P6 or P5 header (header.format) followed by every
+ * raw sample, written to the file descriptor of fp with writev. Anything
+ * already buffered in fp is flushed first.
+ */
+extern void IO_write_raw_ppm(FILE *fp, IO_ppm_header header,
+                             const unsigned char *pixels);
+
+/*
+ * Whole-image output that hands its buffer over. IO_new_output returns an
+ * uninitialized, page-aligned buffer of nbytes. IO_send_raw_ppm and
+ * IO_send_binary write a header and such a buffer of raw samples or
+ * codewords, then free it; IO_send_binary writes format 3 with tiles of
+ * tile x tile blocks when tile is nonzero, and format 2 otherwise. When fp
+ * is a pipe the buffer's pages are passed to the pipe with vmsplice rather
+ * than copied into it, except for tiled codewords, which are rearranged as
+ * they are written. IO_is_pipe tells whether fp is a pipe.
+ */
+extern int IO_is_pipe(FILE *fp);
+extern unsigned char *IO_new_output(size_t nbytes);
+extern void IO_send_raw_ppm(FILE *fp, IO_ppm_header header,
+                            unsigned char *pixels);
+extern void IO_send_binary(FILE *fp, unsigned width, unsigned height,
+                           unsigned char *payload, int blocksize,
+                           int codelength, unsigned tile);
+
+/*
+ * Positional output, for writers whose threads each own a fixed range of
+ * the output. IO_positional_start flushes fp and returns the offset of its
+ * position, or -1 if fp is not a regular file that pwrite can address (e.g.
+ * a pipe, or a file opened for appending). IO_reserve allocates the file
+ * up to end ahead of time where the file system allows it. IO_write_at then
+ * writes bytes at any offset from any thread, and IO_positional_end moves fp
+ * to the given offset past everything written that way.
+ */
+extern off_t IO_positional_start(FILE *fp);
+extern void IO_reserve(FILE *fp, off_t end);
+extern void IO_write_at(FILE *fp, const void *bytes, size_t nbytes,
+                        off_t offset);
+extern void IO_positional_end(FILE *fp, off_t end);
+
+/* Store word at index of payload, the inverse of IO_get_word */
+extern void IO_put_word(unsigned char *payload, size_t index, uint64_t word,
+                        int codelength);
+
+/* Streaming output: a raw PPM header, then rows of raw samples as they are */
+extern void IO_write_ppm_header(FILE *fp, unsigned width, unsigned height,
+                                unsigned denominator);
+extern void IO_write_ppm_rows(FILE *fp, const unsigned char *rows,
+                              size_t nbytes);
+
+/*
+ * Page cache use. IO_CACHE_NORMAL leaves caching to the kernel.
+ * IO_CACHE_STREAM is for files read or written once: inputs are read with
+ * sequential readahead, and pages of inputs and outputs are dropped from
+ * the page cache once they are a window behind, outputs after being written
+ * back, so one large job does not evict the cached files of everything else
+ * on the host. IO_release_cache (or IO_release_fd for a bare descriptor)
+ * drops what is left of a file when its job is done; it is a no-op in
+ * IO_CACHE_NORMAL. The mode is set once, before any I/O.
+ */
+typedef enum IO_cache_mode {
+    IO_CACHE_NORMAL, IO_CACHE_STREAM
+} IO_cache_mode;
+
+extern void IO_set_cache_mode(IO_cache_mode mode);
+extern void IO_release_cache(FILE *fp);
+extern void IO_release_fd(int fd);
+
 #undef T 
 #undef T_Interface
 #endif
\ No newline at end of file
@@ -4,8 +4,8 @@
 #include <math.h>
 
 #include "assert.h"
-#include "pnm.h"
 #include "a2methods.h"
+#include "pnm.h"
 #include "a2blocked.h"
 
 double power(unsigned denominator_1, unsigned denominator_2, unsigned num1, 
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "utest.h"
+#include "except.h"
+#include "assert.h"
+#include "ring.h"
+
+UTEST(Ring, GetsInPutOrderAcrossWraparound)
+{
+    Ring_T ring = Ring_new(3);
+    uintptr_t next_put = 1, next_get = 1;
+
+    /* Rounds of three leave the indexes at every offset in the ring */
+    for (int round = 0; round < 50; round++) {
+        for (int k = 0; k < 3; k++) {
+            Ring_put(ring, (void *) next_put++);
+        }
+        for (int k = 0; k < 3; k++) {
+            EXPECT_EQ(next_get++, (uintptr_t) Ring_get(ring));
+        }
+    }
+
+    Ring_free(&ring);
+}
+
+UTEST(Ring, HoldsHintRoundedUpToPowerOfTwo)
+{
+    /* Putting more than it holds would wait forever on one thread */
+    Ring_T ring = Ring_new(5);
+    for (uintptr_t k = 1; k <= 8; k++) {
+        Ring_put(ring, (void *) k);
+    }
+    for (uintptr_t k = 1; k <= 8; k++) {
+        EXPECT_EQ(k, (uintptr_t) Ring_get(ring));
+    }
+
+    Ring_free(&ring);
+}
+
+UTEST(Ring, ZeroHintRaises)
+{
+    volatile int raised = 0;
+    TRY
+        Ring_T ring = Ring_new(0);
+        Ring_free(&ring);
+    EXCEPT(Assert_Failed)
+        raised = 1;
+    END_TRY;
+    EXPECT_EQ(1, raised);
+}
+
+/* Elements passed between the threads of the two-thread test */
+#define COUNT 20000
+
+/* Pause every this many elements, long enough for the other side to sleep */
+#define STALL 5000
+
+static void *produce(void *cl)
+{
+    Ring_T ring = cl;
+    for (uintptr_t k = 1; k <= COUNT; k++) {
+        if (k % STALL == 0) {
+            usleep(20000);
+        }
+        Ring_put(ring, (void *) k);
+    }
+
+    return NULL;
+}
+
+UTEST(Ring, PassesEveryElementBetweenThreads)
+{
+    Ring_T ring = Ring_new(4);
+    pthread_t producer;
+    ASSERT_EQ(0, pthread_create(&producer, NULL, produce, ring));
+
+    /* The consumer stalls too, so the producer waits on a full ring */
+    int in_order = 1;
+    for (uintptr_t k = 1; k <= COUNT; k++) {
+        if (k % STALL == STALL / 2) {
+            usleep(20000);
+        }
+        in_order = in_order && (uintptr_t) Ring_get(ring) == k;
+    }
+    EXPECT_TRUE(in_order);
+
+    pthread_join(producer, NULL);
+    Ring_free(&ring);
+}
@@ -0,0 +1,142 @@
+/*
+ * ring.c
+ *
+ * Assignment: Arith
+ *
+ * Implementation of single-producer/single-consumer rings. head is only
+ * written by the consumer and tail only by the producer; each publishes its
+ * index with a release store and reads the other's with an acquire load, so
+ * an element is fully written before the consumer can see it. The two
+ * indexes sit on separate cache lines so the threads do not contend on them.
+ *
+ * A thread that finds the ring full or empty spins briefly, then sets its
+ * waiting flag and sleeps on a futex on the other thread's index. The other
+ * thread wakes it after moving that index if the flag is set. Each side
+ * stores to its own word and then loads the other's, with a full fence in
+ * between, so either the sleeper sees the new index or the mover sees the
+ * flag; the futex only sleeps while the index is still the one last seen.
+ */
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "ring.h"
+#include "assert.h"
+#include "mem.h"
+
+#define T Ring_T
+
+/* Size of a cache line, used to keep head and tail apart */
+#define LINE 64
+
+/* Times a full or empty ring is checked again before sleeping */
+#define SPINS 1000
+
+struct T {
+    void **elems;
+    unsigned mask;
+    char pad0[LINE];
+    unsigned head;              /* next element to get; consumer only */
+    int producer_waiting;       /* producer asleep on head; producer only */
+    char pad1[LINE];
+    unsigned tail;              /* next element to put; producer only */
+    int consumer_waiting;       /* consumer asleep on tail; consumer only */
+    char pad2[LINE];
+};
+
+/*
+ * wait_while
+ *
+ * Wait until *index is no longer seen, spinning SPINS times before sleeping.
+ * The calling thread owns *waiting.
+ *
+ * @param unsigned *index - Index moved by the other thread
+ * @param unsigned seen   - Value of *index to wait out
+ * @param int *waiting    - Flag that tells the other thread to wake us
+ */
+static void wait_while(unsigned *index, unsigned seen, int *waiting)
+{
+    for (int i = 0; i < SPINS; i++) {
+        if (__atomic_load_n(index, __ATOMIC_ACQUIRE) != seen) {
+            return;
+        }
+    }
+
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (__atomic_load_n(index, __ATOMIC_ACQUIRE) == seen) {
+        /* Returns at once if *index has already moved past seen */
+        syscall(SYS_futex, index, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+/* Wake the other thread if it is asleep on index, which was just moved */
+static void wake(unsigned *index, int *waiting)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        syscall(SYS_futex, index, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+T Ring_new(unsigned hint)
+{
+    assert(hint > 0);
+
+    unsigned length = 1;
+    while (length < hint) {
+        length <<= 1;
+    }
+
+    T ring;
+    NEW(ring);
+    ring->elems = CALLOC(length, sizeof(void *));
+    ring->mask = length - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->producer_waiting = 0;
+    ring->consumer_waiting = 0;
+
+    return ring;
+}
+
+void Ring_free(T *ring)
+{
+    assert(ring != NULL && *ring != NULL);
+
+    FREE((*ring)->elems);
+    FREE(*ring);
+}
+
+void Ring_put(T ring, void *x)
+{
+    assert(ring != NULL);
+
+    /* Indexes wrap around; tail - head is the number of elements */
+    unsigned tail = ring->tail;
+    unsigned head;
+    while (tail - (head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+           > ring->mask) {
+        wait_while(&ring->head, head, &ring->producer_waiting);
+    }
+
+    ring->elems[tail & ring->mask] = x;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    wake(&ring->tail, &ring->consumer_waiting);
+}
+
+void *Ring_get(T ring)
+{
+    assert(ring != NULL);
+
+    unsigned head = ring->head;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+        wait_while(&ring->tail, head, &ring->consumer_waiting);
+    }
+
+    void *x = ring->elems[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    wake(&ring->head, &ring->producer_waiting);
+
+    return x;
+}
@@ -0,0 +1,55 @@
+/*
+ * ring.h
+ *
+ * Assignment: Arith
+ *
+ * Interface for a bounded lock-free queue of pointers between exactly one
+ * producer thread and one consumer thread. Ring_put waits while the ring is
+ * full and Ring_get waits while it is empty; neither takes a lock. A wait
+ * spins briefly and then sleeps, so a stalled producer or consumer does not
+ * keep the other thread busy.
+ */
+#ifndef RING_INCLUDED
+#define RING_INCLUDED
+
+#define T Ring_T
+typedef struct T *T;
+
+/*
+ * Ring_new
+ *
+ * Create an empty ring.
+ *
+ * @param unsigned hint - Minimum number of elements the ring holds; rounded
+ *                        up to a power of two
+ * @return T            - Ring to be freed with Ring_free
+ *
+ * @expect              - An error is raised if hint is 0
+ */
+extern T Ring_new(unsigned hint);
+
+/*
+ * Ring_free
+ *
+ * Free a ring. Elements still in it are not freed.
+ */
+extern void Ring_free(T *ring);
+
+/*
+ * Ring_put
+ *
+ * Append x, waiting for room if the ring is full. Only the producer thread
+ * may call Ring_put.
+ */
+extern void Ring_put(T ring, void *x);
+
+/*
+ * Ring_get
+ *
+ * Remove and return the oldest element, waiting for one if the ring is
+ * empty. Only the consumer thread may call Ring_get.
+ */
+extern void *Ring_get(T ring);
+
+#undef T
+#endif
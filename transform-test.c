@@ -0,0 +1,273 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utest.h"
+#include "transform.h"
+#include "a2plain.h"
+#include "mem.h"
+
+/* Fill an image with a deterministic pattern covering the full range */
+static A2Methods_UArray2 make_image(A2Methods_T methods, int width, int height,
+                                    unsigned denom)
+{
+    A2Methods_UArray2 image = methods->new(width, height,
+                                           sizeof(struct Pnm_rgb));
+    unsigned seed = 12345;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            Pnm_rgb pixel = methods->at(image, i, j);
+            seed = seed * 1103515245 + 12345;
+            pixel->red = (seed >> 8) % (denom + 1);
+            pixel->green = (seed >> 12) % (denom + 1);
+            pixel->blue = (i * denom / width + j) % (denom + 1);
+        }
+    }
+
+    return image;
+}
+
+static A2Methods_UArray2 staged(A2Methods_UArray2 image, A2Methods_T methods,
+                                unsigned denom)
+{
+    A2Methods_UArray2 rgb = Transform_normalize(image, methods, denom);
+    A2Methods_UArray2 cv = Transform_rgb_to_cv(rgb, methods);
+    A2Methods_UArray2 dct = Transform_cv_to_dct(cv, methods);
+    A2Methods_UArray2 quantized = Transform_quantize_dct(dct, methods);
+    A2Methods_UArray2 word = Transform_dct_to_word(quantized, methods);
+    methods->free(&rgb);
+    methods->free(&cv);
+    methods->free(&dct);
+    methods->free(&quantized);
+
+    return word;
+}
+
+/* Codewords of every block of image, one Transform_encode_block at a time */
+static A2Methods_UArray2 encode_blocks(A2Methods_UArray2 image,
+                                       A2Methods_T methods, unsigned denom)
+{
+    int width = methods->width(image) / 2, height = methods->height(image) / 2;
+    A2Methods_UArray2 word = methods->new(width, height, sizeof(uint64_t));
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            uint64_t *cell = methods->at(word, i, j);
+            *cell = Transform_encode_block(image, methods, i * 2, j * 2,
+                                           denom);
+        }
+    }
+
+    return word;
+}
+
+/* Pixels of every codeword of word, one Transform_decode_block at a time */
+static A2Methods_UArray2 decode_blocks(A2Methods_UArray2 word,
+                                       A2Methods_T methods, unsigned denom)
+{
+    int width = methods->width(word), height = methods->height(word);
+    A2Methods_UArray2 rgb = methods->new(width * 2, height * 2,
+                                         sizeof(struct Pnm_rgb));
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            uint64_t *cell = methods->at(word, i, j);
+            Transform_decode_block(*cell, rgb, methods, i * 2, j * 2, denom);
+        }
+    }
+
+    return rgb;
+}
+
+static int count_mismatch(A2Methods_UArray2 a, A2Methods_UArray2 b,
+                          A2Methods_T methods)
+{
+    int mismatch = 0;
+    for (int j = 0; j < methods->height(a); j++) {
+        for (int i = 0; i < methods->width(a); i++) {
+            uint64_t *x = methods->at(a, i, j), *y = methods->at(b, i, j);
+            mismatch += *x != *y;
+        }
+    }
+
+    return mismatch;
+}
+
+UTEST(Transform, FusedMatchesStaged)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    A2Methods_UArray2 image = make_image(methods, 64, 38, 255);
+    A2Methods_UArray2 reference = staged(image, methods, 255);
+    A2Methods_UArray2 fused = encode_blocks(image, methods, 255);
+
+    EXPECT_EQ(methods->width(reference), methods->width(fused));
+    EXPECT_EQ(methods->height(reference), methods->height(fused));
+    EXPECT_EQ(0, count_mismatch(reference, fused, methods));
+
+    methods->free(&image);
+    methods->free(&reference);
+    methods->free(&fused);
+}
+
+UTEST(Transform, FusedMatchesStagedWideDenominator)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    A2Methods_UArray2 image = make_image(methods, 10, 6, 65535);
+    A2Methods_UArray2 reference = staged(image, methods, 65535);
+    A2Methods_UArray2 fused = encode_blocks(image, methods, 65535);
+
+    EXPECT_EQ(0, count_mismatch(reference, fused, methods));
+
+    methods->free(&image);
+    methods->free(&reference);
+    methods->free(&fused);
+}
+
+UTEST(Transform, FusedDecoderMatchesStaged)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    A2Methods_UArray2 image = make_image(methods, 32, 18, 255);
+    A2Methods_UArray2 word = encode_blocks(image, methods, 255);
+
+    A2Methods_UArray2 dct = Transform_word_to_dct(word, methods);
+    A2Methods_UArray2 unquantized = Transform_unquantize_dct(dct, methods);
+    A2Methods_UArray2 cv = Transform_dct_to_cv(unquantized, methods);
+    A2Methods_UArray2 reference = Transform_cv_to_rgb(cv, methods, 255);
+    A2Methods_UArray2 fused = decode_blocks(word, methods, 255);
+
+    int mismatch = 0;
+    for (int j = 0; j < methods->height(reference); j++) {
+        for (int i = 0; i < methods->width(reference); i++) {
+            Pnm_rgb x = methods->at(reference, i, j);
+            Pnm_rgb y = methods->at(fused, i, j);
+            mismatch += x->red != y->red || x->green != y->green ||
+                        x->blue != y->blue;
+        }
+    }
+    EXPECT_EQ(0, mismatch);
+
+    methods->free(&image);
+    methods->free(&word);
+    methods->free(&dct);
+    methods->free(&unquantized);
+    methods->free(&cv);
+    methods->free(&reference);
+    methods->free(&fused);
+}
+
+/* Raw P6 samples of image, as they are laid out in the file */
+static unsigned char *make_raw(A2Methods_UArray2 image, A2Methods_T methods,
+                               unsigned denom, size_t *stride)
+{
+    int width = methods->width(image), height = methods->height(image);
+    int bytes = denom > 255 ? 2 : 1;
+    *stride = (size_t) width * 3 * bytes;
+    unsigned char *raw = malloc(*stride * height);
+    unsigned char *p = raw;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            Pnm_rgb pixel = methods->at(image, i, j);
+            unsigned samples[] = {pixel->red, pixel->green, pixel->blue};
+            for (int k = 0; k < 3; k++) {
+                if (bytes == 2) {
+                    *p++ = samples[k] >> 8;
+                }
+                *p++ = samples[k] & 0xff;
+            }
+        }
+    }
+
+    return raw;
+}
+
+UTEST(Transform, NormalizedRowsMatchBlock)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    unsigned denoms[] = {255, 1023, 65535};
+    for (int d = 0; d < 3; d++) {
+        A2Methods_UArray2 image = make_image(methods, 12, 8, denoms[d]);
+        size_t stride = 0;
+        unsigned char *raw = make_raw(image, methods, denoms[d], &stride);
+        float *table = Transform_normal_table(denoms[d]);
+        float top[12 * 3], bottom[12 * 3];
+        int bytes = denoms[d] > 255 ? 2 : 1;
+
+        int mismatch = 0;
+        for (int row = 0; row < 8; row += 2) {
+            Transform_normalize_row(raw + row * stride, 12 * 3, bytes,
+                                    table, top);
+            Transform_normalize_row(raw + (row + 1) * stride, 12 * 3, bytes,
+                                    table, bottom);
+            for (int col = 0; col < 12; col += 2) {
+                uint64_t expected = Transform_encode_block(image, methods,
+                                                           col, row,
+                                                           denoms[d]);
+                mismatch += expected != Transform_encode_normal(top, bottom,
+                                                                col);
+            }
+        }
+        EXPECT_EQ(0, mismatch);
+
+        FREE(table);
+        free(raw);
+        methods->free(&image);
+    }
+}
+
+UTEST(Transform, RawDecoderMatchesBlock)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    unsigned denoms[] = {255, 65535};
+    for (int d = 0; d < 2; d++) {
+        A2Methods_UArray2 image = make_image(methods, 12, 8, 255);
+        A2Methods_UArray2 word = encode_blocks(image, methods, 255);
+        A2Methods_UArray2 rgb = decode_blocks(word, methods, denoms[d]);
+        size_t stride = 0;
+        unsigned char *expected = make_raw(rgb, methods, denoms[d], &stride);
+        unsigned char *raw = calloc(stride * 8, 1);
+
+        for (int row = 0; row < 8; row += 2) {
+            unsigned char *top = raw + row * stride;
+            for (int col = 0; col < 12; col += 2) {
+                uint64_t *cell = methods->at(word, col / 2, row / 2);
+                Transform_decode_raw(*cell, top, top + stride, col,
+                                     denoms[d]);
+            }
+        }
+        EXPECT_EQ(0, memcmp(expected, raw, stride * 8));
+
+        free(raw);
+        free(expected);
+        methods->free(&rgb);
+        methods->free(&word);
+        methods->free(&image);
+    }
+}
+
+UTEST(Transform, GrayCodewordRoundTrip)
+{
+    /* A smooth gradient survives the luma-only codeword closely */
+    unsigned char raw[2][8], decoded[2][8];
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 8; i++) {
+            raw[j][i] = 40 + 20 * i + 10 * j;
+        }
+    }
+    float *table = Transform_normal_table(255);
+    float top[8], bottom[8];
+    Transform_normalize_row(raw[0], 8, 1, table, top);
+    Transform_normalize_row(raw[1], 8, 1, table, bottom);
+
+    int worst = 0;
+    for (int col = 0; col < 8; col += 2) {
+        uint64_t word = Transform_encode_gray(top, bottom, col);
+        EXPECT_EQ(0u, (unsigned) (word >> GRAY_CODE_LENGTH));
+        Transform_decode_gray(word, decoded[0], decoded[1], col, 255);
+    }
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 8; i++) {
+            int error = abs(decoded[j][i] - raw[j][i]);
+            worst = error > worst ? error : worst;
+        }
+    }
+    EXPECT_LE(worst, 4);
+
+    FREE(table);
+}
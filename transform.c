@@ -10,7 +10,9 @@
  * followed by the corresponding public function.
  *
  * The implementation always creates a new 2D array for each step. This is 
- * to avoid pointers management.
+ * to avoid pointers management. The per-pixel and per-block math of every
+ * step lives in a helper shared by the staged apply functions and the fused
+ * kernel, so both paths produce the same codewords.
  */
 #include "transform.h"
 #include "formulas.h"
@@ -25,6 +27,8 @@
 const unsigned A_WIDTH = 9, BCD_WIDTH = 5, PBR_WIDTH = 4; 
 const unsigned A_LSB = 23, B_LSB = 18, C_LSB = 13, D_LSB = 8;
 const unsigned PB_LSB = 4, PR_LSB = 0;
+const unsigned GRAY_A_LSB = 15, GRAY_B_LSB = 10, GRAY_C_LSB = 5;
+const unsigned GRAY_D_LSB = 0;
 
 const float A_RANGE = 511.0, BCD_DENOM = 0.3, BCD_RANGE = 15.0;
 
@@ -174,8 +178,174 @@ static void get_pixel(T image, T_Interface methods, CVideo *arr, int i, int j)
     arr[3] = methods->at(image, i + 1, j + 1);
 }
 
+/*
+ * get_rgb
+ *
+ * Same as get_pixel, but for a 2 x 2 block of Pnm_rgb pixels. This is used in
+ * Transform_encode_block.
+ *
+ * @param T image             - Image to extract 2 x 2 pixels from
+ * @param T_Interface methods - Struct pointers of type A2Methods_T 
+ * @param Pnm_rgb *arr        - An array to store pointer to each cell
+ * @param int i               - Starting col of the current block
+ * @param int j               - Starting row of the current block
+ *
+ * @expect                    - An error is raised if methods, methods->at, or
+ *                              arr is null
+ */
+static void get_rgb(T image, T_Interface methods, Pnm_rgb *arr, int i, int j)
+{
+    assert(methods != NULL);
+    assert(methods->at != NULL);
+    assert(arr != NULL);
+    arr[0] = methods->at(image, i, j);
+    arr[1] = methods->at(image, i + 1, j);
+    arr[2] = methods->at(image, i, j + 1);
+    arr[3] = methods->at(image, i + 1, j + 1);
+}
+
 /******************************* COMPRESSION **********************************/
 
+/*
+ * normalize_pixel
+ *
+ * Divide each channel of an rgb pixel by the denominator. Shared by
+ * apply_normalization and the fused kernel.
+ *
+ * @param Pnm_rgb input               - Pixel to be normalized
+ * @param unsigned denominator        - Maximum value of a channel
+ * @return struct Normalized_rgb      - Channels in range [0, 1]
+ */
+static struct Normalized_rgb normalize_pixel(Pnm_rgb input,
+                                             unsigned denominator)
+{
+    struct Normalized_rgb output = {
+        .red = Formulas_normalize(input->red, denominator),
+        .green = Formulas_normalize(input->green, denominator),
+        .blue = Formulas_normalize(input->blue, denominator)
+    };
+
+    return output;
+}
+
+/*
+ * rgb_to_cv
+ *
+ * Convert a normalized rgb pixel to cv components.
+ *
+ * @param Normalized_rgb rgb - Pixel with channels in range [0, 1]
+ * @return struct CVideo     - y, pb, and pr of the pixel
+ */
+static struct CVideo rgb_to_cv(Normalized_rgb rgb)
+{
+    float r = rgb->red, g = rgb->green, b = rgb->blue;
+    struct CVideo cv = {
+        .y = Formulas_calculate_y(r, g, b),
+        .pb = Formulas_calculate_pb(r, g, b),
+        .pr = Formulas_calculate_pr(r, g, b)
+    };
+
+    return cv;
+}
+
+/*
+ * cv_to_dct
+ *
+ * Compute the DCT component of a 2 x 2 block of cv pixels.
+ *
+ * @param CVideo *pixels - BLOCKSIZE x BLOCKSIZE pixels in the order filled by
+ *                         get_pixel
+ * @return struct DCT    - Averaged chroma and cosine coefficients
+ */
+static struct DCT cv_to_dct(CVideo *pixels)
+{
+    float pb[] = {pixels[0]->pb, pixels[1]->pb, pixels[2]->pb, pixels[3]->pb};
+    float pr[] = {pixels[0]->pr, pixels[1]->pr, pixels[2]->pr, pixels[3]->pr};
+    float y_1 = pixels[0]->y;
+    float y_2 = pixels[1]->y;
+    float y_3 = pixels[2]->y;
+    float y_4 = pixels[3]->y;
+
+    struct DCT block = {
+        .pb = Formulas_average(pb, sizeof(pb) / sizeof(pb[0])),
+        .pr = Formulas_average(pr, sizeof(pr) / sizeof(pr[0])),
+        .a = Formulas_calculate_a(y_1, y_2, y_3, y_4),
+        .b = Formulas_calculate_b(y_1, y_2, y_3, y_4),
+        .c = Formulas_calculate_c(y_1, y_2, y_3, y_4),
+        .d = Formulas_calculate_d(y_1, y_2, y_3, y_4)
+    };
+
+    return block;
+}
+
+/*
+ * quantize_luma
+ *
+ * Quantize a, b, c, and d of a block into their codeword ranges. pb and pr
+ * of the result are 0.
+ *
+ * @param DCT block                - Unquantized block
+ * @return struct Word_component   - Luma fields ready to be packed
+ */
+static struct Word_component quantize_luma(DCT block)
+{
+    /* Enforce b, c, and d into range [-BCD_DENOM, BCD_DENOM] */
+    float b = Formulas_set_range(block->b, -1.0 * BCD_DENOM,
+                                 BCD_DENOM);
+    float c = Formulas_set_range(block->c, -1.0 * BCD_DENOM,
+                                 BCD_DENOM);
+    float d = Formulas_set_range(block->d, -1.0 * BCD_DENOM,
+                                 BCD_DENOM);
+
+    struct Word_component word = {.pb = 0, .pr = 0};
+    /* Quantize a into range [0, A_RANGE] */
+    word.a = Formulas_quantize(block->a, 1.0, A_RANGE);
+    /* Quantize b, c, and d into range [-BCD_RANGE, BCD_RANGE] */
+    word.b = Formulas_quantize(b, BCD_DENOM, BCD_RANGE);
+    word.c = Formulas_quantize(c, BCD_DENOM, BCD_RANGE);
+    word.d = Formulas_quantize(d, BCD_DENOM, BCD_RANGE);
+
+    return word;
+}
+
+/*
+ * quantize_dct
+ *
+ * Quantize a, b, c, d, pb, and pr of a block into their codeword ranges.
+ *
+ * @param DCT block                - Unquantized block
+ * @return struct Word_component   - Fields ready to be packed
+ */
+static struct Word_component quantize_dct(DCT block)
+{
+    struct Word_component word = quantize_luma(block);
+    word.pb = Arith40_index_of_chroma(block->pb);
+    word.pr = Arith40_index_of_chroma(block->pr);
+
+    return word;
+}
+
+/*
+ * pack_word
+ *
+ * Bitpack quantized fields into a codeword.
+ *
+ * @param Word_component component - Quantized fields
+ * @return uint64_t                - Codeword in the low CODE_LENGTH bits
+ */
+static uint64_t pack_word(Word_component component)
+{
+    uint64_t word = 0;
+    word = Bitpack_newu(word, A_WIDTH, A_LSB, component->a);
+    word = Bitpack_news(word, BCD_WIDTH, B_LSB, component->b);
+    word = Bitpack_news(word, BCD_WIDTH, C_LSB, component->c);
+    word = Bitpack_news(word, BCD_WIDTH, D_LSB, component->d);
+    word = Bitpack_newu(word, PBR_WIDTH, PB_LSB, component->pb);
+    word = Bitpack_newu(word, PBR_WIDTH, PR_LSB, component->pr);
+
+    return word;
+}
+
 /*
  * apply_normalization
  *
@@ -197,16 +367,12 @@ static void apply_normalization(int i, int j, T image, void *ptr, void *cl)
     check_map_param(ptr, cl);
 
     Closure closure = cl;
-    unsigned denominator = closure->denominator;
     /* Normalized pixel */
     Normalized_rgb output = ptr;
     /* Input pixel */
     Pnm_rgb input = closure->methods->at(closure->image, i, j);
 
-    /* Divide rgb by denominator */
-    output->red = Formulas_normalize(input->red, denominator);
-    output->green = Formulas_normalize(input->green, denominator);
-    output->blue = Formulas_normalize(input->blue, denominator);
+    *output = normalize_pixel(input, closure->denominator);
 }
 
 /*
@@ -264,11 +430,7 @@ static void apply_rgb2cv(int i, int j, T image, void *ptr, void *cl)
     CVideo cv = ptr;
     Normalized_rgb rgb = closure->methods->at(closure->image, i, j);
 
-    /* Convert normalized rgb to cv components */
-    float r = rgb->red, g = rgb->green, b = rgb->blue;
-    cv->y = Formulas_calculate_y(r, g, b);
-    cv->pb = Formulas_calculate_pb(r, g, b);
-    cv->pr = Formulas_calculate_pr(r, g, b);
+    *cv = rgb_to_cv(rgb);
 }
 
 /*
@@ -326,19 +488,7 @@ static void apply_cv2dct(int i, int j, T image, void *ptr, void *cl)
     CVideo pixels[BLOCKSIZE * BLOCKSIZE];
     get_pixel(closure->image, closure->methods, pixels, col, row);
 
-    float pb[] = {pixels[0]->pb, pixels[1]->pb, pixels[2]->pb, pixels[3]->pb};
-    float pr[] = {pixels[0]->pr, pixels[1]->pr, pixels[2]->pr, pixels[3]->pr};
-    float y_1 = pixels[0]->y;
-    float y_2 = pixels[1]->y;
-    float y_3 = pixels[2]->y;
-    float y_4 = pixels[3]->y;
-
-    block->pb = Formulas_average(pb, sizeof(pb) / sizeof(pb[0]));
-    block->pr = Formulas_average(pr, sizeof(pr) / sizeof(pr[0]));
-    block->a = Formulas_calculate_a(y_1, y_2, y_3, y_4);
-    block->b = Formulas_calculate_b(y_1, y_2, y_3, y_4);
-    block->c = Formulas_calculate_c(y_1, y_2, y_3, y_4);
-    block->d = Formulas_calculate_d(y_1, y_2, y_3, y_4);
+    *block = cv_to_dct(pixels);
 }
 
 /*
@@ -394,22 +544,7 @@ static void apply_quantize_dct(int i, int j, T image, void *ptr, void *cl)
     Word_component word = ptr;
     DCT block = closure->methods->at(closure->image, i, j);
 
-    /* Enforce b, c, and d into range [-BCD_DENOM, BCD_DENOM] */
-    float b = Formulas_set_range(block->b, -1.0 * BCD_DENOM,
-                                 BCD_DENOM);
-    float c = Formulas_set_range(block->c, -1.0 * BCD_DENOM,
-                                 BCD_DENOM);
-    float d = Formulas_set_range(block->d, -1.0 * BCD_DENOM,
-                                 BCD_DENOM);
-
-    /* Quantize a into range [0, A_RANGE] */
-    word->a = Formulas_quantize(block->a, 1.0, A_RANGE);
-    /* Quantize b, c, and d into range [-BCD_RANGE, BCD_RANGE] */
-    word->b = Formulas_quantize(b, BCD_DENOM, BCD_RANGE);
-    word->c = Formulas_quantize(c, BCD_DENOM, BCD_RANGE);
-    word->d = Formulas_quantize(d, BCD_DENOM, BCD_RANGE);
-    word->pb = Arith40_index_of_chroma(block->pb);
-    word->pr = Arith40_index_of_chroma(block->pr);
+    *word = quantize_dct(block);
 }
 
 /*
@@ -463,15 +598,7 @@ static void apply_dct2word(int i, int j, T image, void *ptr, void *cl)
     uint64_t *word_p = ptr;
     Word_component component = closure->methods->at(closure->image, i, j);
 
-    uint64_t word = 0;
-    word = Bitpack_newu(word, A_WIDTH, A_LSB, component->a);
-    word = Bitpack_news(word, BCD_WIDTH, B_LSB, component->b);
-    word = Bitpack_news(word, BCD_WIDTH, C_LSB, component->c);
-    word = Bitpack_news(word, BCD_WIDTH, D_LSB, component->d);
-    word = Bitpack_newu(word, PBR_WIDTH, PB_LSB, component->pb);
-    word = Bitpack_newu(word, PBR_WIDTH, PR_LSB, component->pr);
-
-    *word_p = word;
+    *word_p = pack_word(component);
 }
 
 /*
@@ -500,10 +627,326 @@ T Transform_dct_to_word(T image, T_Interface methods)
     return codeword;
 }
 
+/*
+ * encode_normal
+ *
+ * Compress a 2 x 2 block of normalized pixels, in the order given by
+ * get_rgb, into a codeword.
+ *
+ * @param Normalized_rgb *normed - The four pixels of the block
+ * @return uint64_t              - Packed codeword
+ */
+static uint64_t encode_normal(Normalized_rgb *normed)
+{
+    struct CVideo cv[BLOCKSIZE * BLOCKSIZE];
+    CVideo pixels[BLOCKSIZE * BLOCKSIZE];
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        cv[n] = rgb_to_cv(normed[n]);
+        pixels[n] = &cv[n];
+    }
+
+    struct DCT block = cv_to_dct(pixels);
+    struct Word_component component = quantize_dct(&block);
+
+    return pack_word(&component);
+}
+
+/*
+ * encode_rgb
+ *
+ * Compress a 2 x 2 block of pixels, in the order given by get_rgb, into a
+ * codeword.
+ *
+ * @param Pnm_rgb *rgb   - The four pixels of the block
+ * @param unsigned denom - Denominator for normalization
+ * @return uint64_t      - Packed codeword
+ */
+static uint64_t encode_rgb(Pnm_rgb *rgb, unsigned denom)
+{
+    struct Normalized_rgb normed[BLOCKSIZE * BLOCKSIZE];
+    Normalized_rgb pixels[BLOCKSIZE * BLOCKSIZE];
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        normed[n] = normalize_pixel(rgb[n], denom);
+        pixels[n] = &normed[n];
+    }
+
+    return encode_normal(pixels);
+}
+
+/*
+ * Transform_encode_block
+ *
+ * Compress the BLOCKSIZE x BLOCKSIZE block whose top-left pixel is at
+ * (col, row) into a codeword.
+ *
+ * @param T image             - 2D array where each cell is represented by
+ *                              Pnm_rgb
+ * @param T_Interface methods - Struct pointers of type A2Methods_T
+ * @param int col, row        - Top-left pixel of the block
+ * @param unsigned denom      - Denominator for normalization
+ * @return uint64_t           - Packed codeword
+ *
+ * @expect                    - An error is raised if methods or methods->at
+ *                              is null
+ */
+uint64_t Transform_encode_block(T image, T_Interface methods, int col,
+                                int row, unsigned denom)
+{
+    Pnm_rgb rgb[BLOCKSIZE * BLOCKSIZE];
+    get_rgb(image, methods, rgb, col, row);
+
+    return encode_rgb(rgb, denom);
+}
+
+/*
+ * Transform_normal_table
+ *
+ * Normalize every value a raw sample can hold, 0 to 255 for one-byte samples
+ * and 0 to 65535 for two-byte samples, with Formulas_normalize. Values above
+ * denom are clamped to 1 just as Formulas_normalize clamps them.
+ *
+ * @param unsigned denom - Denominator for normalization
+ * @return float *       - Table to be freed with FREE
+ */
+float *Transform_normal_table(unsigned denom)
+{
+    assert(denom > 0);
+
+    unsigned length = denom > 255 ? 65536 : 256;
+    float *table = CALLOC(length, sizeof(float));
+    for (unsigned v = 0; v < length; v++) {
+        table[v] = Formulas_normalize(v, denom);
+    }
+
+    return table;
+}
+
+/*
+ * Transform_normalize_row
+ *
+ * Normalize a row of raw P6 samples by table lookup, with no division. Two-
+ * byte samples are read big-endian.
+ *
+ * @param const unsigned char *row - Raw samples of the row
+ * @param int samples              - Number of samples in the row
+ * @param int bytes                - Bytes per sample, 1 or 2
+ * @param const float *table       - Table from Transform_normal_table
+ * @param float *normed            - Output, one float per sample
+ *
+ * @expect                         - An error is raised if row, table, or
+ *                                   normed is null
+ */
+void Transform_normalize_row(const unsigned char *row, int samples,
+                             int bytes, const float *table, float *normed)
+{
+    assert(row != NULL && table != NULL && normed != NULL);
+
+    if (bytes == 1) {
+        for (int k = 0; k < samples; k++) {
+            normed[k] = table[row[k]];
+        }
+    } else {
+        for (int k = 0; k < samples; k++) {
+            normed[k] = table[(row[2 * k] << 8) | row[2 * k + 1]];
+        }
+    }
+}
+
+/*
+ * Transform_encode_normal
+ *
+ * Compress the block whose left pixel is at col of two rows produced by
+ * Transform_normalize_row.
+ *
+ * @param const float *top    - First row of the block
+ * @param const float *bottom - Second row of the block
+ * @param int col             - Left pixel of the block
+ * @return uint64_t           - Packed codeword
+ *
+ * @expect                    - An error is raised if top or bottom is null
+ */
+uint64_t Transform_encode_normal(const float *top, const float *bottom,
+                                 int col)
+{
+    assert(top != NULL && bottom != NULL);
+
+    /* Same order as get_rgb; a row holds red, green, blue per pixel */
+    const float *corners[BLOCKSIZE * BLOCKSIZE];
+    corners[0] = top + col * 3;
+    corners[1] = top + (col + 1) * 3;
+    corners[2] = bottom + col * 3;
+    corners[3] = bottom + (col + 1) * 3;
+    struct Normalized_rgb normed[BLOCKSIZE * BLOCKSIZE];
+    Normalized_rgb pixels[BLOCKSIZE * BLOCKSIZE];
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        normed[n].red = corners[n][0];
+        normed[n].green = corners[n][1];
+        normed[n].blue = corners[n][2];
+        pixels[n] = &normed[n];
+    }
+
+    return encode_normal(pixels);
+}
+
+/*
+ * Transform_encode_gray
+ *
+ * Compress the block whose left pixel is at col of two rows of normalized
+ * gray samples into a luma-only codeword. A gray sample is its own luma, so
+ * no chroma is computed.
+ *
+ * @param const float *top    - First row of the block
+ * @param const float *bottom - Second row of the block
+ * @param int col             - Left pixel of the block
+ * @return uint64_t           - Codeword in the low GRAY_CODE_LENGTH bits
+ *
+ * @expect                    - An error is raised if top or bottom is null
+ */
+uint64_t Transform_encode_gray(const float *top, const float *bottom, int col)
+{
+    assert(top != NULL && bottom != NULL);
+
+    float y_1 = top[col], y_2 = top[col + 1];
+    float y_3 = bottom[col], y_4 = bottom[col + 1];
+    struct DCT block = {
+        .pb = 0, .pr = 0,
+        .a = Formulas_calculate_a(y_1, y_2, y_3, y_4),
+        .b = Formulas_calculate_b(y_1, y_2, y_3, y_4),
+        .c = Formulas_calculate_c(y_1, y_2, y_3, y_4),
+        .d = Formulas_calculate_d(y_1, y_2, y_3, y_4)
+    };
+    struct Word_component component = quantize_luma(&block);
+
+    uint64_t word = 0;
+    word = Bitpack_newu(word, A_WIDTH, GRAY_A_LSB, component.a);
+    word = Bitpack_news(word, BCD_WIDTH, GRAY_B_LSB, component.b);
+    word = Bitpack_news(word, BCD_WIDTH, GRAY_C_LSB, component.c);
+    word = Bitpack_news(word, BCD_WIDTH, GRAY_D_LSB, component.d);
+
+    return word;
+}
+
 /*************************** END COMPRESSION **********************************/
 
 /***************************** DECOMPRESSION **********************************/
 
+/*
+ * unpack_word
+ *
+ * Extract the quantized fields of a codeword. Shared by apply_word2dct and
+ * the fused kernel.
+ *
+ * @param uint64_t word          - Codeword in the low CODE_LENGTH bits
+ * @return struct Word_component - Quantized fields
+ */
+static struct Word_component unpack_word(uint64_t word)
+{
+    struct Word_component codeword = {
+        .a = Bitpack_getu(word, A_WIDTH, A_LSB),
+        .b = Bitpack_gets(word, BCD_WIDTH, B_LSB),
+        .c = Bitpack_gets(word, BCD_WIDTH, C_LSB),
+        .d = Bitpack_gets(word, BCD_WIDTH, D_LSB),
+        .pb = Bitpack_getu(word, PBR_WIDTH, PB_LSB),
+        .pr = Bitpack_getu(word, PBR_WIDTH, PR_LSB)
+    };
+
+    return codeword;
+}
+
+/*
+ * unquantize_luma
+ *
+ * Map quantized fields back to a, b, c, and d. pb and pr of the result are
+ * 0.
+ *
+ * @param Word_component word - Fields extracted from a codeword
+ * @return struct DCT         - Unquantized luma of the block
+ */
+static struct DCT unquantize_luma(Word_component word)
+{
+    struct DCT block = {.pb = 0, .pr = 0};
+    /* Enforce a into range [0, 1] */
+    block.a = Formulas_inverse_quantize(word->a, 1.0, A_RANGE);
+    /* Enforce b, c, and d into range [-0.3, 0.3] */
+    block.b = Formulas_inverse_quantize(word->b, BCD_DENOM, BCD_RANGE);
+    block.c = Formulas_inverse_quantize(word->c, BCD_DENOM, BCD_RANGE);
+    block.d = Formulas_inverse_quantize(word->d, BCD_DENOM, BCD_RANGE);
+
+    return block;
+}
+
+/*
+ * unquantize_dct
+ *
+ * Map quantized fields back to a, b, c, d, pb, and pr.
+ *
+ * @param Word_component word - Fields extracted from a codeword
+ * @return struct DCT         - Unquantized block
+ */
+static struct DCT unquantize_dct(Word_component word)
+{
+    struct DCT block = unquantize_luma(word);
+    block.pb = Arith40_chroma_of_index(word->pb);
+    block.pr = Arith40_chroma_of_index(word->pr);
+
+    return block;
+}
+
+/*
+ * dct_to_cv
+ *
+ * Recover the cv value of each pixel in a 2 x 2 block.
+ *
+ * @param DCT block      - Unquantized block
+ * @param CVideo *pixels - BLOCKSIZE x BLOCKSIZE cells in the order filled by
+ *                         get_pixel
+ */
+static void dct_to_cv(DCT block, CVideo *pixels)
+{
+    float a = block->a, b = block->b, c = block->c, d = block->d;
+    float y[BLOCKSIZE * BLOCKSIZE];
+    y[0] = Formulas_calculate_y1(a, b, c, d);
+    y[1] = Formulas_calculate_y2(a, b, c, d);
+    y[2] = Formulas_calculate_y3(a, b, c, d);
+    y[3] = Formulas_calculate_y4(a, b, c, d);
+
+    for (int i = 0; i < BLOCKSIZE * BLOCKSIZE; i++) {
+        struct CVideo cv = {
+            .y = y[i],
+            .pb = block->pb,
+            .pr = block->pr
+        };
+        *(pixels[i]) = cv;
+    }
+}
+
+/*
+ * cv_to_rgb
+ *
+ * Convert a cv pixel to rgb in range [0, denom].
+ *
+ * @param CVideo cv      - Pixel in cv representation
+ * @param Pnm_rgb rgb    - Output pixel
+ * @param unsigned denom - Maximum value of the output pixel
+ */
+static void cv_to_rgb(CVideo cv, Pnm_rgb rgb, unsigned denom)
+{
+    float y = cv->y, pb = cv->pb, pr = cv->pr;
+    float r = Formulas_calculate_inverse_r(y, pb, pr);
+    float g = Formulas_calculate_inverse_g(y, pb, pr);
+    float b = Formulas_calculate_inverse_b(y, pb, pr);
+    
+    /* Enforce rgb into range [0, 1] */
+    r = Formulas_set_range(r, 0.0, 1.0);
+    g = Formulas_set_range(g, 0.0, 1.0);
+    b = Formulas_set_range(b, 0.0, 1.0);
+
+    /* Quantize rgb into range [0, denom] */
+    rgb->red = (unsigned) Formulas_quantize(r, 1.0, denom);
+    rgb->green = (unsigned) Formulas_quantize(g, 1.0, denom);
+    rgb->blue = (unsigned) Formulas_quantize(b, 1.0, denom);
+}
+
 /*
  * apply_cv2rgb
  *
@@ -527,21 +970,7 @@ static void apply_cv2rgb(int i, int j, T image, void *ptr, void *cl)
     Pnm_rgb rgb = ptr;
     CVideo cv = closure->methods->at(closure->image, i, j);
 
-    unsigned denom = closure->denominator;
-    float y = cv->y, pb = cv->pb, pr = cv->pr;
-    float r = Formulas_calculate_inverse_r(y, pb, pr);
-    float g = Formulas_calculate_inverse_g(y, pb, pr);
-    float b = Formulas_calculate_inverse_b(y, pb, pr);
-    
-    /* Enforce rgb into range [0, 1] */
-    r = Formulas_set_range(r, 0.0, 1.0);
-    g = Formulas_set_range(g, 0.0, 1.0);
-    b = Formulas_set_range(b, 0.0, 1.0);
-
-    /* Quantize rgb into range [0, denom] */
-    rgb->red = (unsigned) Formulas_quantize(r, 1.0, denom);
-    rgb->green = (unsigned) Formulas_quantize(g, 1.0, denom);
-    rgb->blue = (unsigned) Formulas_quantize(b, 1.0, denom);
+    cv_to_rgb(cv, rgb, closure->denominator);
 }
 
 /*
@@ -597,28 +1026,11 @@ static void apply_dct2cv(int i, int j, T image, void *ptr, void *cl)
     Closure closure = cl;
     DCT block = ptr;
 
-    int num_cell = BLOCKSIZE * BLOCKSIZE;
     int col = i * BLOCKSIZE, row = j * BLOCKSIZE;
-    CVideo pixels[num_cell];
+    CVideo pixels[BLOCKSIZE * BLOCKSIZE];
     get_pixel(closure->image, closure->methods, pixels, col, row);
 
-    float a = block->a, b = block->b, c = block->c, d = block->d;
-    float *y = CALLOC(num_cell, sizeof(float));
-    y[0] = Formulas_calculate_y1(a, b, c, d);
-    y[1] = Formulas_calculate_y2(a, b, c, d);
-    y[2] = Formulas_calculate_y3(a, b, c, d);
-    y[3] = Formulas_calculate_y4(a, b, c, d);
-
-    for (int i = 0; i < num_cell; i++) {
-        struct CVideo cv = {
-            .y = y[i],
-            .pb = block->pb,
-            .pr = block->pr
-        };
-        *(pixels[i]) = cv;
-    }
-
-	FREE(y);
+    dct_to_cv(block, pixels);
 }
 
 /*
@@ -672,14 +1084,7 @@ static void apply_unquantize_dct(int i, int j, T image, void *ptr, void *cl)
     DCT block = ptr;
     Word_component word = closure->methods->at(closure->image, i, j);
 
-    /* Enforce a into range [0, 1] */
-    block->a = Formulas_inverse_quantize(word->a, 1.0, A_RANGE);
-    /* Enforce b, c, and d into range [-0.3, 0.3] */
-    block->b = Formulas_inverse_quantize(word->b, BCD_DENOM, BCD_RANGE);
-    block->c = Formulas_inverse_quantize(word->c, BCD_DENOM, BCD_RANGE);
-    block->d = Formulas_inverse_quantize(word->d, BCD_DENOM, BCD_RANGE);
-    block->pb = Arith40_chroma_of_index(word->pb);
-    block->pr = Arith40_chroma_of_index(word->pr);
+    *block = unquantize_dct(word);
 }
 
 /*
@@ -732,12 +1137,7 @@ static void apply_word2dct(int i, int j, T image, void *ptr, void *cl)
     uint64_t word = *(uint64_t *) closure->methods->at(closure->image, i, j);
     Word_component codeword = ptr;
 
-    codeword->a = Bitpack_getu(word, A_WIDTH, A_LSB);
-    codeword->b = Bitpack_gets(word, BCD_WIDTH, B_LSB);
-    codeword->c = Bitpack_gets(word, BCD_WIDTH, C_LSB);
-    codeword->d = Bitpack_gets(word, BCD_WIDTH, D_LSB);
-    codeword->pb = Bitpack_getu(word, PBR_WIDTH, PB_LSB);
-    codeword->pr = Bitpack_getu(word, PBR_WIDTH, PR_LSB);
+    *codeword = unpack_word(word);
 }
 
 /*
@@ -767,6 +1167,170 @@ T Transform_word_to_dct(T image, T_Interface methods)
     return dct;
 }
 
+/*
+ * decode_rgb
+ *
+ * Decompress a codeword into a 2 x 2 block of pixels, in the order given by
+ * get_rgb.
+ *
+ * @param uint64_t word  - Codeword in the low CODE_LENGTH bits
+ * @param Pnm_rgb *rgb   - The four pixels of the block
+ * @param unsigned denom - The maximum pixel value of the output image
+ */
+static void decode_rgb(uint64_t word, Pnm_rgb *rgb, unsigned denom)
+{
+    struct Word_component component = unpack_word(word);
+    struct DCT block = unquantize_dct(&component);
+
+    struct CVideo cv[BLOCKSIZE * BLOCKSIZE];
+    CVideo pixels[BLOCKSIZE * BLOCKSIZE];
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        pixels[n] = &cv[n];
+    }
+    dct_to_cv(&block, pixels);
+
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        cv_to_rgb(pixels[n], rgb[n], denom);
+    }
+}
+
+/*
+ * Transform_decode_block
+ *
+ * Decompress a codeword into the BLOCKSIZE x BLOCKSIZE block whose top-left
+ * pixel is at (col, row).
+ *
+ * @param uint64_t word       - Codeword in the low CODE_LENGTH bits
+ * @param T image             - 2D array where each cell is represented by
+ *                              Pnm_rgb
+ * @param T_Interface methods - Struct pointers of type A2Methods_T
+ * @param int col, row        - Top-left pixel of the block
+ * @param unsigned denom      - The maximum pixel value of the output image
+ *
+ * @expect                    - An error is raised if methods or methods->at
+ *                              is null
+ */
+void Transform_decode_block(uint64_t word, T image, T_Interface methods,
+                            int col, int row, unsigned denom)
+{
+    Pnm_rgb rgb[BLOCKSIZE * BLOCKSIZE];
+    get_rgb(image, methods, rgb, col, row);
+    decode_rgb(word, rgb, denom);
+}
+
+/*
+ * put_raw
+ *
+ * Write a pixel at col of a row of raw P6 samples.
+ *
+ * @param unsigned char *row - Raw samples of the row
+ * @param int col            - Column of the pixel
+ * @param int bytes          - Bytes per sample, 1 or 2
+ * @param Pnm_rgb pixel      - The pixel
+ */
+static inline void put_raw(unsigned char *row, int col, int bytes,
+                           Pnm_rgb pixel)
+{
+    unsigned char *p = row + (size_t) col * 3 * bytes;
+    if (bytes == 1) {
+        p[0] = pixel->red;
+        p[1] = pixel->green;
+        p[2] = pixel->blue;
+    } else {
+        p[0] = pixel->red >> 8;
+        p[1] = pixel->red;
+        p[2] = pixel->green >> 8;
+        p[3] = pixel->green;
+        p[4] = pixel->blue >> 8;
+        p[5] = pixel->blue;
+    }
+}
+
+/*
+ * Transform_decode_raw
+ *
+ * Decompress a codeword straight into two rows of raw P6 samples.
+ *
+ * @param uint64_t word         - Codeword in the low CODE_LENGTH bits
+ * @param unsigned char *top    - First pixel row of the block
+ * @param unsigned char *bottom - Second pixel row of the block
+ * @param int col               - Left pixel of the block
+ * @param unsigned denom        - The maximum pixel value of the output image
+ *
+ * @expect                      - An error is raised if top or bottom is null
+ */
+void Transform_decode_raw(uint64_t word, unsigned char *top,
+                          unsigned char *bottom, int col, unsigned denom)
+{
+    assert(top != NULL && bottom != NULL);
+
+    struct Pnm_rgb block[BLOCKSIZE * BLOCKSIZE];
+    Pnm_rgb rgb[BLOCKSIZE * BLOCKSIZE];
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        rgb[n] = &block[n];
+    }
+    decode_rgb(word, rgb, denom);
+
+    /* Same order as get_rgb */
+    int bytes = denom > 255 ? 2 : 1;
+    put_raw(top, col, bytes, rgb[0]);
+    put_raw(top, col + 1, bytes, rgb[1]);
+    put_raw(bottom, col, bytes, rgb[2]);
+    put_raw(bottom, col + 1, bytes, rgb[3]);
+}
+
+/*
+ * Transform_decode_gray
+ *
+ * Decompress a luma-only codeword straight into two rows of raw gray
+ * samples, one byte per sample or two big-endian bytes when denom is above
+ * 255.
+ *
+ * @param uint64_t word         - Codeword in the low GRAY_CODE_LENGTH bits
+ * @param unsigned char *top    - First pixel row of the block
+ * @param unsigned char *bottom - Second pixel row of the block
+ * @param int col               - Left pixel of the block
+ * @param unsigned denom        - The maximum pixel value of the output image
+ *
+ * @expect                      - An error is raised if top or bottom is null
+ */
+void Transform_decode_gray(uint64_t word, unsigned char *top,
+                           unsigned char *bottom, int col, unsigned denom)
+{
+    assert(top != NULL && bottom != NULL);
+
+    struct Word_component component = {
+        .a = Bitpack_getu(word, A_WIDTH, GRAY_A_LSB),
+        .b = Bitpack_gets(word, BCD_WIDTH, GRAY_B_LSB),
+        .c = Bitpack_gets(word, BCD_WIDTH, GRAY_C_LSB),
+        .d = Bitpack_gets(word, BCD_WIDTH, GRAY_D_LSB),
+        .pb = 0, .pr = 0
+    };
+    struct DCT block = unquantize_luma(&component);
+    float a = block.a, b = block.b, c = block.c, d = block.d;
+    float y[BLOCKSIZE * BLOCKSIZE];
+    y[0] = Formulas_calculate_y1(a, b, c, d);
+    y[1] = Formulas_calculate_y2(a, b, c, d);
+    y[2] = Formulas_calculate_y3(a, b, c, d);
+    y[3] = Formulas_calculate_y4(a, b, c, d);
+
+    /* Same order as get_rgb */
+    int bytes = denom > 255 ? 2 : 1;
+    unsigned char *cells[BLOCKSIZE * BLOCKSIZE];
+    cells[0] = top + (size_t) col * bytes;
+    cells[1] = top + (size_t) (col + 1) * bytes;
+    cells[2] = bottom + (size_t) col * bytes;
+    cells[3] = bottom + (size_t) (col + 1) * bytes;
+    for (int n = 0; n < BLOCKSIZE * BLOCKSIZE; n++) {
+        float v = Formulas_set_range(y[n], 0.0, 1.0);
+        unsigned sample = (unsigned) Formulas_quantize(v, 1.0, denom);
+        if (bytes == 2) {
+            *cells[n]++ = sample >> 8;
+        }
+        *cells[n] = sample;
+    }
+}
+
 /*************************** END DECOMPRESSION ********************************/
 
 #undef T
@@ -14,8 +14,9 @@
 #ifndef TRANSFORM_INCLUDED
 #define TRANSFORM_INCLUDED
 
-#include "pnm.h"
+#include <stdint.h>
 #include "a2methods.h"
+#include "pnm.h"
 
 #define T A2Methods_UArray2
 #define T_Interface A2Methods_T
@@ -33,6 +34,12 @@ static const int BLOCKSIZE = 2;
  */
 static const int CODE_LENGTH = 32; 
 
+/*
+ * Pack length of each luma-only codeword of a grayscale image: a, b, c, and
+ * d without the 8 bits of chroma.
+ */
+static const int GRAY_CODE_LENGTH = 24;
+
 /******************************* COMPRESSION **********************************/
 
 /*
@@ -130,6 +137,96 @@ extern T Transform_quantize_dct(T image, T_Interface methods);
  */
 extern T Transform_dct_to_word(T image, T_Interface methods);
 
+/*
+ * Transform_encode_block
+ *
+ * Compress one BLOCKSIZE x BLOCKSIZE block of an RGB image into a codeword
+ * in a single pass. The result is identical to running Transform_normalize
+ * through Transform_dct_to_word, which remain available as the reference
+ * path.
+ *
+ * @param T image             - 2D array where each cell is represented by
+ *                              Pnm_rgb
+ * @param T_Interface methods - A method suites to interact with T
+ * @param int col, row        - Top-left pixel of the block in image
+ * @param unsigned denom      - Maximum value in the input image
+ * @return uint64_t           - Codeword in the low CODE_LENGTH bits
+ *
+ * @expect                    - It is an unchecked error for the block to 
+ *                              extend past the edge of image
+ * @expect                    - It is a checked runtime error to pass in 
+ *                              null methods
+ */
+extern uint64_t Transform_encode_block(T image, T_Interface methods, int col,
+                                       int row, unsigned denom);
+
+/*
+ * Transform_normal_table
+ *
+ * Normalized value of every raw sample, so rows of raw P6 samples can be
+ * normalized by lookup. The table has 256 entries, or 65536 when denom is
+ * above 255, and matches Formulas_normalize exactly.
+ *
+ * @param unsigned denom - Maximum value in the input image
+ * @return float *       - Table to be freed with FREE
+ */
+extern float *Transform_normal_table(unsigned denom);
+
+/*
+ * Transform_normalize_row
+ *
+ * Convert a row of raw P6 samples to normalized floats with a table from
+ * Transform_normal_table.
+ *
+ * @param const unsigned char *row - Raw samples of the row
+ * @param int samples              - Number of samples in the row: 3 per
+ *                                   pixel for P6, 1 per pixel for P5
+ * @param int bytes                - Bytes per sample: 1, or 2 big-endian
+ *                                   bytes when the denominator is above 255
+ * @param const float *table       - Table from Transform_normal_table
+ * @param float *normed            - One float per sample; red, green, and
+ *                                   blue of each pixel for P6
+ */
+extern void Transform_normalize_row(const unsigned char *row, int samples,
+                                    int bytes, const float *table,
+                                    float *normed);
+
+/*
+ * Transform_encode_normal
+ *
+ * Same as Transform_encode_block, but the block is read from two rows of
+ * Transform_normalize_row.
+ *
+ * @param const float *top    - First pixel row of the block
+ * @param const float *bottom - Second pixel row of the block
+ * @param int col             - Left pixel of the block
+ * @return uint64_t           - Codeword in the low CODE_LENGTH bits
+ *
+ * @expect                    - It is an unchecked error for the block to
+ *                              extend past the end of a row
+ */
+extern uint64_t Transform_encode_normal(const float *top, const float *bottom,
+                                        int col);
+
+/*
+ * Transform_encode_gray
+ *
+ * Compress one block of a grayscale image into a luma-only codeword. The
+ * sample is the luma, so none of the chroma steps run. The codeword holds
+ * a (9 bits) and b, c, d (5 bits each) in its low GRAY_CODE_LENGTH bits.
+ *
+ * @param const float *top    - First row of the block, from
+ *                              Transform_normalize_row over P5 samples
+ * @param const float *bottom - Second row of the block
+ * @param int col             - Left pixel of the block
+ * @return uint64_t           - Codeword in the low GRAY_CODE_LENGTH bits
+ *
+ * @expect                    - It is an unchecked error for the block to
+ *                              extend past the end of a row
+ */
+extern uint64_t Transform_encode_gray(const float *top, const float *bottom,
+                                      int col);
+
 /*************************** END COMPRESSION **********************************/
 
 
@@ -212,6 +309,68 @@ extern T Transform_unquantize_dct(T image, T_Interface methods);
  */
 extern T Transform_word_to_dct(T image, T_Interface methods);
 
+/*
+ * Transform_decode_block
+ *
+ * Decompress one codeword into a BLOCKSIZE x BLOCKSIZE block of an RGB image
+ * in a single pass. The result is identical to running Transform_word_to_dct
+ * through Transform_cv_to_rgb.
+ *
+ * @param uint64_t word       - Codeword in the low CODE_LENGTH bits
+ * @param T image             - 2D array where each cell is represented by
+ *                              Pnm_rgb
+ * @param T_Interface methods - A method suites to interact with T
+ * @param int col, row        - Top-left pixel of the block in image
+ * @param unsigned denom      - The maximum pixel value of the output image
+ *
+ * @expect                    - It is an unchecked error for the block to 
+ *                              extend past the edge of image
+ * @expect                    - It is a checked runtime error to pass in 
+ *                              null methods
+ */
+extern void Transform_decode_block(uint64_t word, T image, T_Interface methods,
+                                   int col, int row, unsigned denom);
+
+/*
+ * Transform_decode_raw
+ *
+ * Same as Transform_decode_block, but the block is written straight into two
+ * rows of raw P6 samples: one byte per sample, or two big-endian bytes when
+ * denom is above 255.
+ *
+ * @param uint64_t word         - Codeword in the low CODE_LENGTH bits
+ * @param unsigned char *top    - First pixel row of the block
+ * @param unsigned char *bottom - Second pixel row of the block
+ * @param int col               - Left pixel of the block
+ * @param unsigned denom        - The maximum pixel value of the output image
+ *
+ * @expect                      - It is an unchecked error for the block to
+ *                                extend past the end of a row
+ */
+extern void Transform_decode_raw(uint64_t word, unsigned char *top,
+                                 unsigned char *bottom, int col,
+                                 unsigned denom);
+
+/*
+ * Transform_decode_gray
+ *
+ * Decompress a codeword of Transform_encode_gray straight into two rows of
+ * raw P5 samples: one byte per sample, or two big-endian bytes when denom
+ * is above 255.
+ *
+ * @param uint64_t word         - Codeword in the low GRAY_CODE_LENGTH bits
+ * @param unsigned char *top    - First pixel row of the block
+ * @param unsigned char *bottom - Second pixel row of the block
+ * @param int col               - Left pixel of the block
+ * @param unsigned denom        - The maximum pixel value of the output image
+ *
+ * @expect                      - It is an unchecked error for the block to
+ *                                extend past the end of a row
+ */
+extern void Transform_decode_gray(uint64_t word, unsigned char *top,
+                                  unsigned char *bottom, int col,
+                                  unsigned denom);
+
 /*************************** END DECOMPRESSION ********************************/
 
 #undef T
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include "utest.h"
+#include "except.h"
+#include "assert.h"
+#include "a2methods.h"
+#include "a2plain.h"
+#include "a2blocked.h"
+#include "uarray2.h"
+
+#define WIDTH 6
+#define HEIGHT 5
+
+/* The value stored at (i, j) of a fresh array */
+static int value(int i, int j)
+{
+    return 100 * j + i;
+}
+
+static UArray2_T make_array(void)
+{
+    UArray2_T array = UArray2_new(WIDTH, HEIGHT, sizeof(int));
+    for (int j = 0; j < HEIGHT; j++) {
+        for (int i = 0; i < WIDTH; i++) {
+            *(int *) UArray2_at(array, i, j) = value(i, j);
+        }
+    }
+
+    return array;
+}
+
+/* Elements seen by a row-major map, checked against the view's origin */
+struct Visit {
+    int col, row, count, wrong;
+};
+
+static void visit(int i, int j, UArray2_T array, void *elem, void *cl)
+{
+    struct Visit *v = cl;
+    (void) array;
+    v->wrong += *(int *) elem != value(v->col + i, v->row + j);
+    v->count++;
+}
+
+UTEST(UArray2, ViewReadsWithColumnOffset)
+{
+    UArray2_T array = make_array();
+    UArray2_T view = UArray2_view(array, 2, 1, 3, 3);
+    EXPECT_EQ(3, UArray2_width(view));
+    EXPECT_EQ(3, UArray2_height(view));
+    EXPECT_EQ((int) sizeof(int), UArray2_size(view));
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 3; i++) {
+            EXPECT_EQ(value(2 + i, 1 + j), *(int *) UArray2_at(view, i, j));
+        }
+    }
+
+    struct Visit v = {2, 1, 0, 0};
+    UArray2_map_row_major(view, visit, &v);
+    EXPECT_EQ(9, v.count);
+    EXPECT_EQ(0, v.wrong);
+
+    /* A view shares its parent's elements */
+    *(int *) UArray2_at(view, 0, 0) = -1;
+    EXPECT_EQ(-1, *(int *) UArray2_at(array, 2, 1));
+    *(int *) UArray2_at(view, 0, 0) = value(2, 1);
+
+    /* The column offsets of nested views add up */
+    UArray2_T inner = UArray2_view(view, 1, 1, 2, 2);
+    struct Visit w = {3, 2, 0, 0};
+    UArray2_map_row_major(inner, visit, &w);
+    EXPECT_EQ(4, w.count);
+    EXPECT_EQ(0, w.wrong);
+    EXPECT_EQ(value(4, 3), *(int *) UArray2_at(inner, 1, 1));
+
+    /* Freeing the innermost view frees every array under it */
+    UArray2_free(&inner);
+    EXPECT_TRUE(inner == NULL);
+}
+
+UTEST(UArray2, FreeingAViewThroughMethods)
+{
+    A2Methods_T methods = uarray2_methods_plain;
+    ASSERT_TRUE(methods->view != NULL);
+
+    A2Methods_UArray2 array = make_array();
+    A2Methods_UArray2 view = methods->view(array, 1, 0, WIDTH - 1, HEIGHT - 1);
+    EXPECT_EQ(WIDTH - 1, methods->width(view));
+    EXPECT_EQ(HEIGHT - 1, methods->height(view));
+    EXPECT_EQ(value(1, 0), *(int *) methods->at(view, 0, 0));
+    EXPECT_EQ(value(WIDTH - 1, HEIGHT - 2),
+              *(int *) methods->at(view, WIDTH - 2, HEIGHT - 2));
+
+    methods->free(&view);
+    EXPECT_TRUE(view == NULL);
+
+    /* Blocked arrays have no views */
+    EXPECT_TRUE(uarray2_methods_blocked->view == NULL);
+}
+
+UTEST(UArray2, ViewPastTheEdgeRaises)
+{
+    UArray2_T array = make_array();
+    volatile int raised = 0;
+    TRY
+        UArray2_T view = UArray2_view(array, 4, 0, 3, 1);
+        UArray2_free(&view);
+    EXCEPT(Assert_Failed)
+        raised = 1;
+    END_TRY;
+    EXPECT_EQ(1, raised);
+    UArray2_free(&array);
+}
@@ -16,6 +16,8 @@ struct T {
     int size;
     UArray_T rows; /* UArray_T of 'height' UArray_Ts,
                     each of length 'width' and size 'size' */
+    int col;       /* offset of column 0 within each row; 0 unless a view */
+    T parent;      /* array whose rows a view shares; NULL unless a view */
 };
 
 #line 79 "www/solutions/uarray2.nw"
@@ -30,7 +32,7 @@ static int is_ok(T a)
 {
     return a && UArray_length(a->rows) == a->height &&
             UArray_size(a->rows) == sizeof(UArray_T) &&
-            (a->height == 0 || (UArray_length(row(a, 0)) == a->width
+            (a->height == 0 || (UArray_length(row(a, 0)) >= a->col + a->width
             && UArray_size  (row(a, 0)) == a->size));
 }
 
@@ -44,6 +46,8 @@ T UArray2_new(int width, int height, int size)
     array->height = height;
     array->size   = size;
     array->rows   = UArray_new(height, sizeof(UArray_T));
+    array->col    = 0;
+    array->parent = NULL;
     for (i = 0; i < height; i++) {
         UArray_T *rowp = UArray_at(array->rows, i);
         *rowp = UArray_new(width, size);
@@ -57,19 +61,52 @@ void UArray2_free(T *array2)
 {
     int i;
     assert(array2 && *array2);
-    for (i = 0; i < (*array2)->height; i++) {
-        UArray_T p = row(*array2, i);
-        UArray_free(&p);
+    if ((*array2)->parent != NULL) {
+        /* A view's rows belong to its parent */
+        UArray2_free(&(*array2)->parent);
+    } else {
+        for (i = 0; i < (*array2)->height; i++) {
+            UArray_T p = row(*array2, i);
+            UArray_free(&p);
+        }
     }
     UArray_free(&(*array2)->rows);
     FREE(*array2);
 }
 
+/*
+ * A view gets its own table of row handles, pointing at rows of array2, so
+ * only height pointers are allocated and no element is copied.
+ */
+T UArray2_view(T array2, int col0, int row0, int width, int height)
+{
+    int j;
+    T view;
+    assert(array2);
+    assert(col0 >= 0 && row0 >= 0 && width >= 0 && height >= 0);
+    assert(col0 + width <= array2->width && row0 + height <= array2->height);
+
+    NEW(view);
+    view->width  = width;
+    view->height = height;
+    view->size   = array2->size;
+    view->rows   = UArray_new(height, sizeof(UArray_T));
+    view->col    = array2->col + col0;
+    view->parent = array2;
+    for (j = 0; j < height; j++) {
+        UArray_T *rowp = UArray_at(view->rows, j);
+        *rowp = row(array2, row0 + j);
+    }
+    assert(is_ok(view));
+    return view;
+}
+
 #line 151 "www/solutions/uarray2.nw"
 void *UArray2_at(T array2, int i, int j)
 {
     assert(array2);
-    return UArray_at(row(array2, j), i);
+    assert(i >= 0 && i < array2->width);
+    return UArray_at(row(array2, j), array2->col + i);
 }
 
 #line 162 "www/solutions/uarray2.nw"
@@ -100,11 +137,12 @@ void UArray2_map_row_major(T array2,
     assert(array2);
     int h = array2->height;  /* keeping height and width in registers */
     int w = array2->width;   /* avoids extra memory traffic           */
+    int c = array2->col;
     for (int j = 0; j < h; j++) {
         /* don't want row/UArray_at in inner loop */
         UArray_T thisrow = row(array2, j); 
         for (int i = 0; i < w; i++)
-            apply(i, j, array2, UArray_at(thisrow, i), cl);
+            apply(i, j, array2, UArray_at(thisrow, c + i), cl);
     }
 }
 #line 211 "www/solutions/uarray2.nw"
@@ -116,9 +154,10 @@ void UArray2_map_col_major(T array2,
     assert(array2);
     int h = array2->height;  /* keeping height and width in registers */
     int w = array2->width;   /* avoids extra memory traffic           */
+    int c = array2->col;
     for (int i = 0; i < w; i++)
         for (int j = 0; j < h; j++)
-            apply(i, j, array2, UArray_at(row(array2, j), i), cl);
+            apply(i, j, array2, UArray_at(row(array2, j), c + i), cl);
 }
 
 #undef T
\ No newline at end of file
@@ -48,6 +48,21 @@ extern T     UArray2_new(int width, int height, int size);
  */
 extern void  UArray2_free(T *uarray2);
 
+/* UArray2_view
+ * Purpose: makes a 2-d array that is a window over part of another one, 
+ *          without copying any element
+ * Parameters: 1) uarray2: the object of UArray2_T type to look into
+ *             2) col, row: the index in uarray2 of element (0, 0) of the view
+ *             3) width, height: the number of columns and rows of the view
+ * Return: a 2-d array whose element (i, j) is element (col + i, row + j) of
+ *         uarray2
+ * 
+ * Note: The view takes over uarray2: freeing the view also frees uarray2, 
+ *       and uarray2 must not be freed on its own afterwards. It is a CRE for
+ *       uarray2 to be null or for the window to extend past its bounds.
+ */
+extern T     UArray2_view(T uarray2, int col, int row, int width, int height);
+
 /* UArray2_width
  * Purpose: returns the number of columns in the 2-d array
  * Parameters: an object of type UArray2_T
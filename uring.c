@@ -0,0 +1,222 @@
+/*
+ * uring.c
+ *
+ * Assignment: Arith
+ *
+ * Implementation of io_uring rings on the raw system calls, so no library is
+ * needed. The submission and completion queues are shared with the kernel
+ * through mappings of the ring's descriptor: an entry is filled before the
+ * tail that publishes it is stored (release), and a completion is read only
+ * after its tail is loaded (acquire), as with Ring_T.
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "assert.h"
+#include "mem.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) \
+    && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#define T Uring_T
+
+#ifdef HAVE_IO_URING
+
+struct T {
+    int fd;
+    unsigned entries, queued;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+T Uring_new(unsigned entries)
+{
+    assert(entries > 0);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    T ring;
+    NEW(ring);
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->queued = 0;
+    ring->sq_size = params.sq_off.array + params.sq_entries
+                    * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries
+                    * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Newer kernels share one mapping between the two queues */
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_size > ring->sq_size) {
+        ring->sq_size = ring->cq_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single ? ring->sq_ring
+                           : mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd,
+                                  IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED
+        || ring->sqes == MAP_FAILED) {
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (!single && ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_size);
+        }
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_size);
+        }
+        close(fd);
+        FREE(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return ring;
+}
+
+void Uring_free(T *ring)
+{
+    assert(ring != NULL && *ring != NULL);
+
+    T r = *ring;
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_size);
+    }
+    munmap(r->sq_ring, r->sq_size);
+    close(r->fd);
+    FREE(*ring);
+}
+
+/* Fill in the next submission entry; 0 if the queue is full */
+static int queue(T ring, int opcode, int fd, struct iovec *iov,
+                 uint64_t offset, uint64_t data)
+{
+    assert(ring != NULL && iov != NULL);
+
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->entries) {
+        return 0;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = data;
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return 1;
+}
+
+int Uring_read(T ring, int fd, struct iovec *iov, uint64_t offset,
+               uint64_t data)
+{
+    return queue(ring, IORING_OP_READV, fd, iov, offset, data);
+}
+
+int Uring_write(T ring, int fd, struct iovec *iov, uint64_t offset,
+                uint64_t data)
+{
+    return queue(ring, IORING_OP_WRITEV, fd, iov, offset, data);
+}
+
+void Uring_wait(T ring, uint64_t *data, int *result)
+{
+    assert(ring != NULL && data != NULL && result != NULL);
+
+    unsigned head = *ring->cq_head;
+    while (ring->queued > 0
+           || __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == head) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                                1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            assert(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+            continue;
+        }
+        ring->queued -= submitted;
+    }
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+T Uring_new(unsigned entries)
+{
+    (void) entries;
+    return NULL;
+}
+
+void Uring_free(T *ring)
+{
+    assert(ring != NULL && *ring == NULL);
+}
+
+int Uring_read(T ring, int fd, struct iovec *iov, uint64_t offset,
+               uint64_t data)
+{
+    (void) ring; (void) fd; (void) iov; (void) offset; (void) data;
+    assert(0);
+    return 0;
+}
+
+int Uring_write(T ring, int fd, struct iovec *iov, uint64_t offset,
+                uint64_t data)
+{
+    (void) ring; (void) fd; (void) iov; (void) offset; (void) data;
+    assert(0);
+    return 0;
+}
+
+void Uring_wait(T ring, uint64_t *data, int *result)
+{
+    (void) ring; (void) data; (void) result;
+    assert(0);
+}
+
+#endif
+
+#undef T
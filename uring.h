@@ -0,0 +1,64 @@
+/*
+ * uring.h
+ *
+ * Assignment: Arith
+ *
+ * Interface for a minimal io_uring: reads and writes are queued, submitted
+ * together, and their completions collected one at a time. A ring belongs to
+ * one thread. Uring_new returns NULL where the kernel or the build has no
+ * io_uring, so callers can fall back to plain system calls.
+ */
+#ifndef URING_INCLUDED
+#define URING_INCLUDED
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define T Uring_T
+typedef struct T *T;
+
+/*
+ * Uring_new
+ *
+ * Create a ring.
+ *
+ * @param unsigned entries - Most operations queued or in flight at once;
+ *                           rounded up to a power of two by the kernel
+ * @return T               - Ring to be freed with Uring_free, or NULL if
+ *                           io_uring is not available
+ */
+extern T Uring_new(unsigned entries);
+
+/*
+ * Uring_free
+ *
+ * Free a ring. Operations still in flight are abandoned.
+ */
+extern void Uring_free(T *ring);
+
+/*
+ * Uring_read, Uring_write
+ *
+ * Queue a readv or writev of iov at offset of fd. iov and its buffer must
+ * stay valid until the operation completes. data is handed back by
+ * Uring_wait with the result.
+ *
+ * @return int - 0 if the ring is full, otherwise 1
+ */
+extern int Uring_read(T ring, int fd, struct iovec *iov, uint64_t offset,
+                      uint64_t data);
+extern int Uring_write(T ring, int fd, struct iovec *iov, uint64_t offset,
+                       uint64_t data);
+
+/*
+ * Uring_wait
+ *
+ * Submit every queued operation and wait for one to complete.
+ *
+ * @param uint64_t *data - Set to the data the operation was queued with
+ * @param int *result    - Set to the bytes transferred, or -errno
+ */
+extern void Uring_wait(T ring, uint64_t *data, int *result);
+
+#undef T
+#endif